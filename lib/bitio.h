@@ -30,6 +30,10 @@
 #ifndef __rfxswf_bitio_h__
 #define __rfxswf_bitio_h__
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define READER_TYPE_FILE 1
 #define READER_TYPE_MEM  2
 #define READER_TYPE_ZLIB_U 3
@@ -123,4 +127,8 @@ void* writer_growmemwrite_memptr(writer_t*w, int*len);
 void* writer_growmemwrite_getmem(writer_t*w);
 void writer_growmemwrite_reset(writer_t*w);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //__rfxswf_bitio_h__
@@ -37,6 +37,8 @@
 
 typedef struct _clip {
     gfxpoly_t*poly;
+    gfxbbox_t bbox; // of poly
+    char is_rectangle;
     int openclips;
     struct _clip*next;
 } clip_t;
@@ -45,6 +47,12 @@ typedef struct _internal {
     gfxdevice_t*out;
     clip_t*clip;
     gfxpoly_t*polyunion;
+
+    /* polygons not yet merged into polyunion. They're only combined
+       (all at once) when the union is requested. */
+    gfxpoly_t**pending;
+    int num_pending;
+    int pending_size;
     
     int good_polygons;
     int bad_polygons;
@@ -86,6 +94,30 @@ void polyops_startpage(struct _gfxdevice*dev, int width, int height)
     if(i->out) i->out->startpage(i->out,width,height);
 }
 
+/* intersect poly with the current clip polygon. Most clips are rectangles
+   (or the shape is entirely inside or outside of the clip), so try to get
+   the result from the bounding boxes before doing a full intersection.
+   Returns poly itself if it's inside the clip. */
+static gfxpoly_t* intersect_with_clip(clip_t*clip, gfxpoly_t*poly)
+{
+    gfxbbox_t b = gfxpoly_getbbox(poly);
+    if(b.xmax <= clip->bbox.xmin || b.xmin >= clip->bbox.xmax ||
+       b.ymax <= clip->bbox.ymin || b.ymin >= clip->bbox.ymax) {
+	/* entirely outside */
+	return gfxpoly_from_fill(0, DEFAULT_GRID);
+    }
+    if(clip->is_rectangle) {
+	if(b.xmin >= clip->bbox.xmin && b.xmax <= clip->bbox.xmax &&
+	   b.ymin >= clip->bbox.ymin && b.ymax <= clip->bbox.ymax) {
+	    return poly;
+	}
+	if(gfxpoly_is_rectangle(poly)) {
+	    return gfxpoly_intersect_rectangles(poly, clip->poly);
+	}
+    }
+    return gfxpoly_intersect(poly, clip->poly);
+}
+
 void polyops_startclip(struct _gfxdevice*dev, gfxline_t*line)
 {
     dbg("polyops_startclip");
@@ -121,11 +153,13 @@ void polyops_startclip(struct _gfxdevice*dev, gfxline_t*line)
 	currentclip = 0;
 	type = 2;
     } else if(poly && oldclip) {
-	gfxpoly_t*intersection = gfxpoly_intersect(poly, oldclip);
+	gfxpoly_t*intersection = intersect_with_clip(i->clip, poly);
 	if(intersection) {
             i->good_polygons++;
 	    // this case is what usually happens 
-	    gfxpoly_destroy(poly);poly=0;
+	    if(intersection != poly)
+		gfxpoly_destroy(poly);
+	    poly=0;
 	    currentclip = intersection;
 	    type = 0;
 	} else {
@@ -145,6 +179,10 @@ void polyops_startclip(struct _gfxdevice*dev, gfxline_t*line)
     i->clip->next = n;
     i->clip->poly = currentclip;
     i->clip->openclips = type;
+    if(currentclip) {
+	i->clip->bbox = gfxpoly_getbbox(currentclip);
+	i->clip->is_rectangle = gfxpoly_is_rectangle(currentclip);
+    }
 }
 
 void polyops_endclip(struct _gfxdevice*dev)
@@ -169,15 +207,39 @@ void polyops_endclip(struct _gfxdevice*dev)
     old->next = 0;free(old);
 }
 
+/* takes ownership of poly */
 static void addtounion(struct _gfxdevice*dev, gfxpoly_t*poly)
 {
     internal_t*i = (internal_t*)dev->internal;
-    if(poly && i->polyunion) {
-	gfxpoly_t*old = i->polyunion;
-	gfxpoly_t*newpoly = gfxpoly_union(poly,i->polyunion);
-	i->polyunion = newpoly;
-	gfxpoly_destroy(old);
+    if(!i->polyunion) {
+	gfxpoly_destroy(poly);
+	return;
     }
+    if(i->num_pending == i->pending_size) {
+	i->pending_size = i->pending_size ? i->pending_size*2 : 64;
+	i->pending = (gfxpoly_t**)rfx_realloc(i->pending, sizeof(gfxpoly_t*)*i->pending_size);
+    }
+    i->pending[i->num_pending++] = poly;
+}
+
+static void mergeunion(internal_t*i)
+{
+    if(!i->num_pending)
+	return;
+    /* add the current union to the list, too, and do one sweep over
+       everything- merging polygons one by one would re-process
+       the (growing) union for every single one of them */
+    if(i->num_pending == i->pending_size) {
+	i->pending_size++;
+	i->pending = (gfxpoly_t**)rfx_realloc(i->pending, sizeof(gfxpoly_t*)*i->pending_size);
+    }
+    i->pending[i->num_pending++] = i->polyunion;
+    i->polyunion = gfxpoly_union_many(i->pending, i->num_pending);
+    int t;
+    for(t=0;t<i->num_pending;t++) {
+	gfxpoly_destroy(i->pending[t]);
+    }
+    i->num_pending = 0;
 }
 
 static gfxline_t* handle_poly(gfxdevice_t*dev, gfxpoly_t*poly, char*ok)
@@ -186,8 +248,9 @@ static gfxline_t* handle_poly(gfxdevice_t*dev, gfxpoly_t*poly, char*ok)
     if(i->clip && i->clip->poly) {
 	gfxpoly_t*old = poly;
 	if(poly) {
-	    poly = gfxpoly_intersect(poly, i->clip->poly);
-	    gfxpoly_destroy(old);
+	    poly = intersect_with_clip(i->clip, poly);
+	    if(poly != old)
+		gfxpoly_destroy(old);
 	}
     }
 
@@ -196,12 +259,10 @@ static gfxline_t* handle_poly(gfxdevice_t*dev, gfxpoly_t*poly, char*ok)
     else
         i->bad_polygons++;
 
-    addtounion(dev, poly);
-    gfxline_t*gfxline = 0;
     if(poly) {
 	// this is the case where everything went right
 	gfxline_t*line = gfxline_from_gfxpoly(poly);
-	gfxpoly_destroy(poly);
+	addtounion(dev, poly);
         *ok = 1;
 	return line;
     } else {
@@ -363,6 +424,13 @@ gfxresult_t* polyops_finish(struct _gfxdevice*dev)
     internal_t*i = (internal_t*)dev->internal;
 
     if(i->polyunion) {
+	int t;
+	for(t=0;t<i->num_pending;t++) {
+	    gfxpoly_destroy(i->pending[t]);
+	}
+	if(i->pending) {
+	    free(i->pending);i->pending=0;
+	}
 	gfxpoly_destroy(i->polyunion);i->polyunion=0;
     } else {
         if(i->bad_polygons) {
@@ -381,6 +449,7 @@ gfxresult_t* polyops_finish(struct _gfxdevice*dev)
 gfxline_t*gfxdevice_union_getunion(struct _gfxdevice*dev)
 {
     internal_t*i = (internal_t*)dev->internal;
+    mergeunion(i);
     return gfxline_from_gfxpoly(i->polyunion);
 }
 
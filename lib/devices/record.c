@@ -54,6 +54,8 @@ typedef struct _state {
     gfxcolor_t last_color[16];
     gfxmatrix_t last_matrix[16];
 
+    gfxarena_t*arena;
+
 #ifdef STATS
     int size_matrices;
     int size_positions;
@@ -65,6 +67,13 @@ typedef struct _state {
 #endif
 } state_t;
 
+/* start and end positions of pages or font definitions in the stream */
+typedef struct _ranges {
+    int*pos;
+    int num;
+    int size;
+} ranges_t;
+
 typedef struct _internal {
     gfxfontlist_t* fontlist;
     state_t state;
@@ -72,7 +81,11 @@ typedef struct _internal {
     writer_t w;
     int cliplevel;
     char use_tempfile;
+    char font_references;
     char*filename;
+
+    ranges_t pages;
+    ranges_t fonts;
 } internal_t;
 
 typedef struct _internal_result {
@@ -80,8 +93,24 @@ typedef struct _internal_result {
     char*filename;
     void*data;
     int length;
+
+    char font_references;
+    ranges_t pages;
+    ranges_t fonts;
+    int prologue_start;
+    int prologue_end;
+
+    /* the fonts, decoded by the first gfxresult_record_replay_pages() */
+    gfxfontlist_t*decoded_fonts;
+    char fonts_decoded;
+
+    /* for recordings opened with gfxresult_record_open */
+    memfile_t*file;
 } internal_result_t;
 
+#define INDEX_MAGIC 0x49524647 /* "GFRI" */
+#define INDEX_VERSION 1
+
 #define OP_END 0x00
 #define OP_SETPARAM 0x01
 #define OP_STROKE 0x02
@@ -99,6 +128,7 @@ typedef struct _internal_result {
 
 #define FLAG_SAME_AS_LAST 0x10
 #define FLAG_ZERO_FONT 0x20
+#define FLAG_FONT_REFERENCE 0x40
 
 #define LINE_MOVETO 0x0e
 #define LINE_LINETO 0x0f
@@ -106,6 +136,17 @@ typedef struct _internal_result {
 
 /* ----------------- reading/writing of low level primitives -------------- */
 
+static void ranges_add(ranges_t*r, int start, int end)
+{
+    if(r->num == r->size) {
+	r->size = r->size?r->size*2:16;
+	r->pos = (int*)rfx_realloc(r->pos, r->size*2*sizeof(int));
+    }
+    r->pos[r->num*2] = start;
+    r->pos[r->num*2+1] = end;
+    r->num++;
+}
+
 static void dumpLine(writer_t*w, state_t*state, gfxline_t*line)
 {
     while(line) {
@@ -142,35 +183,31 @@ static void dumpLine(writer_t*w, state_t*state, gfxline_t*line)
 }
 static gfxline_t* readLine(reader_t*r, state_t*s)
 {
-    gfxline_t*start = 0, *pos = 0;
+    /* collect the segments in scratch memory, and then copy them
+       into a single block */
+    if(!s->arena)
+	s->arena = gfxarena_new();
+    gfxpath_t*path = gfxpath_new(s->arena);
     while(1) {
 	unsigned char op = reader_readU8(r);
 	if(op == OP_END)
 	    break;
-	gfxline_t*line = (gfxline_t*)rfx_calloc(sizeof(gfxline_t));
-	if(!start) {
-	    start = pos = line;
-	} else {
-	    pos->next = line;
-	    pos = line;
+	double x=0,y=0,sx=0,sy=0;
+	if(op == LINE_MOVETO || op == LINE_LINETO || op == LINE_SPLINETO) {
+	    x = reader_readDouble(r);
+	    y = reader_readDouble(r);
 	}
-	if(op == LINE_MOVETO) {
-	    line->type = gfx_moveTo;
-	    line->x = reader_readDouble(r);
-	    line->y = reader_readDouble(r);
-	} else if(op == LINE_LINETO) {
-	    line->type = gfx_lineTo;
-	    line->x = reader_readDouble(r);
-	    line->y = reader_readDouble(r);
-	} else if(op == LINE_SPLINETO) {
-	    line->type = gfx_splineTo;
-	    line->x = reader_readDouble(r);
-	    line->y = reader_readDouble(r);
-	    line->sx = reader_readDouble(r);
-	    line->sy = reader_readDouble(r);
+	if(op == LINE_SPLINETO) {
+	    sx = reader_readDouble(r);
+	    sy = reader_readDouble(r);
 	}
+	gfxpath_add(path, op == LINE_MOVETO ? gfx_moveTo :
+	                  op == LINE_LINETO ? gfx_lineTo :
+	                  op == LINE_SPLINETO ? gfx_splineTo : 0, x, y, sx, sy);
     }
-    return start;
+    gfxline_t*line = gfxline_from_gfxpath(path);
+    gfxarena_reset(s->arena);
+    return line;
 }
 
 static void dumpImage(writer_t*w, state_t*state, gfximage_t*img)
@@ -449,6 +486,17 @@ void state_clear(state_t*state)
 	    state->last_string[t] = 0;
 	}
     }
+    if(state->arena) {
+	gfxarena_destroy(state->arena);
+	state->arena = 0;
+    }
+}
+
+static void state_reset(state_t*state)
+{
+    state_clear(state);
+    memset(state->last_color, 0, sizeof(state->last_color));
+    memset(state->last_matrix, 0, sizeof(state->last_matrix));
 }
 
 static char* read_string(reader_t*r, state_t*state, U8 id, U8 flags)
@@ -568,8 +616,15 @@ static void record_addfont(struct _gfxdevice*dev, gfxfont_t*font)
     internal_t*i = (internal_t*)dev->internal;
     msg("<trace> record: %08x ADDFONT %s\n", dev, font->id);
     if(font && !gfxfontlist_hasfont(i->fontlist, font)) {
-	writer_writeU8(&i->w, OP_ADDFONT);
-	dumpFont(&i->w, &i->state, font);
+	if(i->font_references) {
+	    writer_writeU8(&i->w, OP_ADDFONT|FLAG_FONT_REFERENCE);
+	    i->w.write(&i->w, &font, sizeof(font));
+	} else {
+	    int start = i->w.pos;
+	    writer_writeU8(&i->w, OP_ADDFONT);
+	    dumpFont(&i->w, &i->state, font);
+	    ranges_add(&i->fonts, start, i->w.pos);
+	}
 	i->fontlist = gfxfontlist_addfont(i->fontlist, font);
     }
 }
@@ -626,6 +681,12 @@ static void record_startpage(struct _gfxdevice*dev, int width, int height)
 {
     internal_t*i = (internal_t*)dev->internal;
     msg("<trace> record: %08x STARTPAGE\n", dev);
+
+    /* pages don't depend on the state of previous pages, so that they
+       can be replayed on their own */
+    state_reset(&i->state);
+
+    ranges_add(&i->pages, i->w.pos, i->w.pos);
     writer_writeU8(&i->w, OP_STARTPAGE);
     writer_writeU16(&i->w, width);
     writer_writeU16(&i->w, height);
@@ -636,6 +697,9 @@ static void record_endpage(struct _gfxdevice*dev)
     internal_t*i = (internal_t*)dev->internal;
     msg("<trace> record: %08x ENDPAGE\n", dev);
     writer_writeU8(&i->w, OP_ENDPAGE);
+    if(i->pages.num) {
+	i->pages.pos[i->pages.num*2-1] = i->w.pos;
+    }
 }
 
 static void record_drawlink(struct _gfxdevice*dev, gfxline_t*line, const char*action, const char*text)
@@ -650,7 +714,11 @@ static void record_drawlink(struct _gfxdevice*dev, gfxline_t*line, const char*ac
 
 /* ------------------------------- replaying --------------------------------- */
 
-static void replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontlist_t**fontlist)
+/* With lazyfonts set, fonts are only collected in *fontlist when they are
+   defined, and passed to out->addfont() before the first character that
+   uses them. That's for replaying parts of a recording, where fonts may
+   have been defined outside of the replayed part. */
+static void replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontlist_t**fontlist, char lazyfonts)
 {
     internal_t*i = 0;
     if(dev) {
@@ -661,6 +729,8 @@ static void replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontli
 	fontlist = &_fontlist;
     }
 
+    gfxfontlist_t*announced = 0;
+
     state_t state;
     memset(&state, 0, sizeof(state));
 
@@ -689,6 +759,7 @@ static void replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontli
 		msg("<trace> replay: STARTPAGE");
 		U16 width = reader_readU16(r);
 		U16 height = reader_readU16(r);
+		state_reset(&state);
 		out->startpage(out, width, height);
 		break;
 	    }
@@ -786,10 +857,21 @@ static void replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontli
 	    }
 	    case OP_ADDFONT: {
 		msg("<trace> replay: ADDFONT out=%08x(%s)", out, out->name);
-		gfxfont_t*font = readFont(r, &state);
+		gfxfont_t*font = 0;
+		if(flags&FLAG_FONT_REFERENCE) {
+		    r->read(r, &font, sizeof(font));
+		    if(!gfxfontlist_hasfont(*fontlist, font)) {
+			*fontlist = gfxfontlist_addfont(*fontlist, font);
+			if(!lazyfonts)
+			    out->addfont(out, font);
+		    }
+		    break;
+		}
+		font = readFont(r, &state);
 		if(!gfxfontlist_hasfont(*fontlist, font)) {
 		    *fontlist = gfxfontlist_addfont(*fontlist, font);
-		    out->addfont(out, font);
+		    if(!lazyfonts)
+			out->addfont(out, font);
 		} else {
 		    gfxfont_free(font);
 		}
@@ -808,6 +890,10 @@ static void replay(struct _gfxdevice*dev, gfxdevice_t*out, reader_t*r, gfxfontli
 		if(i && !font) {
 		    font = gfxfontlist_findfont(i->fontlist, id);
 		}
+		if(lazyfonts && font && !gfxfontlist_hasfont(announced, font)) {
+		    announced = gfxfontlist_addfont(announced, font);
+		    out->addfont(out, font);
+		}
 		msg("<trace> replay: DRAWCHAR font=%s glyph=%d (flags=%d)", id, glyph, flags);
 		out->drawchar(out, font, glyph, &color, &matrix);
 		if(id)
@@ -821,10 +907,18 @@ finish:
     r->dealloc(r);
     if(_fontlist)
 	gfxfontlist_free(_fontlist, 0);
+    if(announced)
+	gfxfontlist_free(announced, 0);
 }
 void gfxresult_record_replay(gfxresult_t*result, gfxdevice_t*device, gfxfontlist_t**fontlist)
 {
     internal_result_t*i = (internal_result_t*)result->internal;
+
+    if(i->file) {
+	/* indexed recordings only store the pages and the fonts */
+	gfxresult_record_replay_pages(result, device, 1, i->pages.num, fontlist);
+	return;
+    }
     
     reader_t r;
     if(i->use_tempfile) {
@@ -833,7 +927,7 @@ void gfxresult_record_replay(gfxresult_t*result, gfxdevice_t*device, gfxfontlist
 	reader_init_memreader(&r, i->data, i->length);
     }
 
-    replay(0, device, &r, fontlist);
+    replay(0, device, &r, fontlist, 0);
 }
 
 static void record_result_write(gfxresult_t*r, int filedesc)
@@ -872,9 +966,22 @@ static void*record_result_get(gfxresult_t*r, const char*name)
 static void record_result_destroy(gfxresult_t*r)
 {
     internal_result_t*i = (internal_result_t*)r->internal;
+    if(i->file) {
+	memfile_close(i->file);i->file = 0;
+	i->data = 0;
+    }
     if(i->data) {
 	free(i->data);i->data = 0;
     }
+    if(i->pages.pos) {
+	free(i->pages.pos);i->pages.pos = 0;
+    }
+    if(i->fonts.pos) {
+	free(i->fonts.pos);i->fonts.pos = 0;
+    }
+    /* devices we replayed to may still use the fonts, so only the
+       list is freed */
+    gfxfontlist_free(i->decoded_fonts, 0);i->decoded_fonts = 0;
     if(i->filename) {
 	unlink(i->filename);
 	free(i->filename);
@@ -883,6 +990,203 @@ static void record_result_destroy(gfxresult_t*r)
     free(r);
 }
 
+/* ------------------------- indexed recordings ------------------------------ */
+
+static void replay_range(gfxdevice_t*out, void*data, int start, int end, gfxfontlist_t**fontlist)
+{
+    reader_t r;
+    if(end <= start)
+	return;
+    reader_init_memreader(&r, (char*)data + start, end - start);
+    replay(0, out, &r, fontlist, 1);
+}
+
+int gfxresult_record_num_pages(gfxresult_t*result)
+{
+    internal_result_t*i = (internal_result_t*)result->internal;
+    return i->pages.num;
+}
+
+void gfxresult_record_replay_pages(gfxresult_t*result, gfxdevice_t*device, int first, int last, gfxfontlist_t**fontlist)
+{
+    internal_result_t*i = (internal_result_t*)result->internal;
+    gfxfontlist_t*_fontlist = 0;
+    memfile_t*tempfile = 0;
+    void*data = i->data;
+    int t;
+
+    if(first < 1)
+	first = 1;
+    if(last > i->pages.num)
+	last = i->pages.num;
+    if(first > last)
+	return;
+    if(!fontlist)
+	fontlist = &_fontlist;
+
+    if(i->use_tempfile) {
+	tempfile = memfile_open(i->filename);
+	if(!tempfile)
+	    return;
+	data = tempfile->data;
+    }
+
+    /* first make the fonts known, then jump to the first page. Decoding
+       the fonts is expensive, so it's only done once per result. */
+    if(!i->fonts_decoded) {
+	for(t=0;t<i->fonts.num;t++) {
+	    replay_range(device, data, i->fonts.pos[t*2], i->fonts.pos[t*2+1], &i->decoded_fonts);
+	}
+	i->fonts_decoded = 1;
+    }
+    gfxfontlist_t*l;
+    for(l=i->decoded_fonts;l;l=l->next) {
+	if(!gfxfontlist_hasfont(*fontlist, l->font))
+	    *fontlist = gfxfontlist_addfont(*fontlist, l->font);
+    }
+    replay_range(device, data, i->prologue_start, i->prologue_end, fontlist);
+    replay_range(device, data, i->pages.pos[(first-1)*2], i->pages.pos[last*2-1], fontlist);
+
+    if(tempfile)
+	memfile_close(tempfile);
+    if(_fontlist)
+	gfxfontlist_free(_fontlist, 0);
+}
+
+/* Layout of an indexed recording (all numbers are 32 bit little endian):
+     magic, version, number of pages,
+     offset and length of the prologue (everything before the first page),
+     offset and length of the font section (all font definitions),
+     offset and length of every page,
+   followed by the data of these sections. */
+#define INDEX_HEADER_SIZE(pages) (4*(7+2*(pages)))
+
+int gfxresult_record_save_indexed(gfxresult_t*result, const char*filename)
+{
+    internal_result_t*i = (internal_result_t*)result->internal;
+    memfile_t*tempfile = 0;
+    unsigned char*data = (unsigned char*)i->data;
+    int t;
+
+    if(i->font_references) {
+	msg("<error> Can't save a recording which references fonts in memory");
+	return -1;
+    }
+    if(i->use_tempfile) {
+	tempfile = memfile_open(i->filename);
+	if(!tempfile)
+	    return -1;
+	data = (unsigned char*)tempfile->data;
+    }
+
+    FILE*fi = fopen(filename, "wb");
+    if(!fi) {
+	fprintf(stderr, "Couldn't open file %s for writing\n", filename);
+	if(tempfile)
+	    memfile_close(tempfile);
+	return -1;
+    }
+
+    int fonts_length = 0;
+    for(t=0;t<i->fonts.num;t++) {
+	fonts_length += i->fonts.pos[t*2+1] - i->fonts.pos[t*2];
+    }
+
+    writer_t w;
+    writer_init_growingmemwriter(&w, 4096);
+    int pos = INDEX_HEADER_SIZE(i->pages.num);
+    writer_writeU32(&w, INDEX_MAGIC);
+    writer_writeU32(&w, INDEX_VERSION);
+    writer_writeU32(&w, i->pages.num);
+    writer_writeU32(&w, pos);
+    writer_writeU32(&w, i->prologue_end - i->prologue_start);
+    pos += i->prologue_end - i->prologue_start;
+    writer_writeU32(&w, pos);
+    writer_writeU32(&w, fonts_length);
+    pos += fonts_length;
+    for(t=0;t<i->pages.num;t++) {
+	int length = i->pages.pos[t*2+1] - i->pages.pos[t*2];
+	writer_writeU32(&w, pos);
+	writer_writeU32(&w, length);
+	pos += length;
+    }
+    int header_length = 0;
+    void*header = writer_growmemwrite_memptr(&w, &header_length);
+    fwrite(header, header_length, 1, fi);
+    w.finish(&w);
+
+    fwrite(data + i->prologue_start, i->prologue_end - i->prologue_start, 1, fi);
+    for(t=0;t<i->fonts.num;t++) {
+	fwrite(data + i->fonts.pos[t*2], i->fonts.pos[t*2+1] - i->fonts.pos[t*2], 1, fi);
+    }
+    for(t=0;t<i->pages.num;t++) {
+	fwrite(data + i->pages.pos[t*2], i->pages.pos[t*2+1] - i->pages.pos[t*2], 1, fi);
+    }
+    fclose(fi);
+
+    if(tempfile)
+	memfile_close(tempfile);
+    return 0;
+}
+
+static U32 get_u32(unsigned char*p)
+{
+    return p[0] | p[1]<<8 | p[2]<<16 | (U32)p[3]<<24;
+}
+
+gfxresult_t* gfxresult_record_open(const char*filename)
+{
+    memfile_t*file = memfile_open(filename);
+    if(!file)
+	return 0;
+
+    unsigned char*data = (unsigned char*)file->data;
+    int num_pages = file->len >= INDEX_HEADER_SIZE(0) ? get_u32(&data[8]) : -1;
+    if(num_pages < 0 || 
+       get_u32(&data[0]) != INDEX_MAGIC || get_u32(&data[4]) != INDEX_VERSION ||
+       file->len < INDEX_HEADER_SIZE(num_pages)) {
+	msg("<error> %s is not an indexed recording", filename);
+	memfile_close(file);
+	return 0;
+    }
+
+    internal_result_t*ir = (internal_result_t*)rfx_calloc(sizeof(internal_result_t));
+    ir->file = file;
+
+    /* replay_range() works on offsets into the whole file, so unlike
+       in recordings made in memory, the prologue doesn't start at 0 */
+    U32 prologue_pos = get_u32(&data[12]);
+    U32 prologue_len = get_u32(&data[16]);
+    U32 fonts_pos = get_u32(&data[20]);
+    U32 fonts_len = get_u32(&data[24]);
+    int t;
+    for(t=0;t<num_pages;t++) {
+	U32 pos = get_u32(&data[28+t*8]);
+	U32 len = get_u32(&data[32+t*8]);
+	if((U64)pos+len > file->len) {
+	    msg("<error> %s is truncated", filename);
+	    break;
+	}
+	ranges_add(&ir->pages, pos, pos+len);
+    }
+    if((U64)prologue_pos+prologue_len <= file->len) {
+	ir->prologue_start = prologue_pos;
+	ir->prologue_end = prologue_pos+prologue_len;
+    }
+    if((U64)fonts_pos+fonts_len <= file->len)
+	ranges_add(&ir->fonts, fonts_pos, fonts_pos+fonts_len);
+    ir->data = file->data;
+    ir->length = file->len;
+
+    gfxresult_t*result= (gfxresult_t*)rfx_calloc(sizeof(gfxresult_t));
+    result->write = record_result_write;
+    result->save = record_result_save;
+    result->get = record_result_get;
+    result->destroy = record_result_destroy;
+    result->internal = ir;
+    return result;
+}
+
 static unsigned char printable(unsigned char a)
 {
     if(a<32 || a==127) return '.';
@@ -908,6 +1212,12 @@ static void hexdumpMem(unsigned char*data, int len)
     }
 }
 
+void gfxdevice_record_set_font_references(gfxdevice_t*dev, char on)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    i->font_references = on;
+}
+
 void gfxdevice_record_show(gfxdevice_t*dev)
 {
     internal_t*i = (internal_t*)dev->internal;
@@ -921,7 +1231,7 @@ void gfxdevice_record_show(gfxdevice_t*dev)
 
     reader_t r;
     reader_init_memreader(&r, data, len);
-    replay(dev, &out, &r, NULL);
+    replay(dev, &out, &r, NULL, 0);
 }
 
 void gfxdevice_record_flush(gfxdevice_t*dev, gfxdevice_t*out, gfxfontlist_t**fontlist)
@@ -933,8 +1243,10 @@ void gfxdevice_record_flush(gfxdevice_t*dev, gfxdevice_t*out, gfxfontlist_t**fon
 	    void*data = writer_growmemwrite_memptr(&i->w, &len);
 	    reader_t r;
 	    reader_init_memreader(&r, data, len);
-	    replay(dev, out, &r, fontlist);
+	    replay(dev, out, &r, fontlist, 0);
 	    writer_growmemwrite_reset(&i->w);
+	    i->pages.num = 0;
+	    i->fonts.num = 0;
 	} else {
 	    msg("<fatal> Flushing not supported for file based record device");
 	    exit(1);
@@ -969,12 +1281,16 @@ static gfxresult_t* record_finish(struct _gfxdevice*dev)
     }
 #endif
     
+    internal_result_t*ir = (internal_result_t*)rfx_calloc(sizeof(internal_result_t));
+    ir->prologue_end = i->pages.num ? i->pages.pos[0] : i->w.pos;
+    ir->pages = i->pages;
+    ir->fonts = i->fonts;
+    ir->font_references = i->font_references;
+
     writer_writeU8(&i->w, OP_END);
     
     gfxfontlist_free(i->fontlist, 0);
    
-    internal_result_t*ir = (internal_result_t*)rfx_calloc(sizeof(gfxresult_t));
-   
     ir->use_tempfile = i->use_tempfile;
     if(i->use_tempfile) {
 	ir->filename = i->filename;
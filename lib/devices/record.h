@@ -40,6 +40,27 @@ void gfxresult_record_replay(gfxresult_t*, gfxdevice_t*, gfxfontlist_t**);
 
 void gfxdevice_record_show(gfxdevice_t*dev);
 
+/* Replay only pages first to last (counting from 1) of a recording. Fonts
+   defined on earlier pages are taken from the recording's font table, so
+   the pages before first don't need to be decoded. The font table is
+   decoded on the first call, and kept with the result for later ones. */
+void gfxresult_record_replay_pages(gfxresult_t*, gfxdevice_t*, int first, int last, gfxfontlist_t**);
+
+int gfxresult_record_num_pages(gfxresult_t*);
+
+/* Save a recording as an indexed file, with a page table and a section
+   holding all fonts. Recordings with font references can't be saved. */
+int gfxresult_record_save_indexed(gfxresult_t*, const char*filename);
+
+/* Map an indexed recording into memory. Replaying a page range of the
+   returned result reads the pages directly from the mapped file. */
+gfxresult_t* gfxresult_record_open(const char*filename);
+
+/* Store only pointers to fonts instead of serializing them. The fonts have
+   to outlive the recording, and it can only be replayed in this process.
+   Fonts added to the replay fontlist are then not owned by it. */
+void gfxdevice_record_set_font_references(gfxdevice_t*dev, char on);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,6 +22,10 @@
 #include <stdio.h>
 #include <math.h>
 #include <memory.h>
+#include "../../config.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include "../gfxdevice.h"
 #include "../gfxtools.h"
 #include "../mem.h"
@@ -29,20 +33,23 @@
 #include "../png.h"
 #include "../log.h"
 #include "render.h"
+#include "record.h"
 
 typedef gfxcolor_t RGBA;
 
-typedef struct _renderpoint
-{
-    float x;
-} renderpoint_t;
-
-typedef struct _renderline
+/* an edge of the polygon currently being filled. x is the crossing of
+   the edge with the center of scanline y1, stepx the change of x per
+   scanline. Edges are chained into per-scanline lists by their first
+   scanline, so fill() can add them to the active edge table in order. */
+typedef struct _renderedge
 {
-    renderpoint_t*points;
-    int size;
-    int num;
-} renderline_t;
+    double x;
+    double stepx;
+    double posx;
+    float cur;
+    int y1, y2;
+    int next;
+} renderedge_t;
 
 typedef struct _internal_result {
     gfximage_t img;
@@ -66,6 +73,21 @@ typedef struct _internal {
     int zoom;
     int ymin, ymax;
     int fillwhite;
+    int coverage;
+    int aa;
+
+    /* tiled mode: the page is recorded, and rasterized in bands of
+       bandheight rows by up to threads threads */
+    int threads;
+    int bandheight;
+    gfxdevice_t*record;
+    int page_width, page_height;
+
+    /* for band devices: the first row of the band, in output pixels
+       and in scanlines */
+    int band_y;
+    int band_rows;
+    int yshift;
 
     char palette;
 
@@ -73,7 +95,14 @@ typedef struct _internal {
 
     clipbuffer_t*clipbuf;
 
-    renderline_t*lines;
+    renderedge_t*edges;
+    int num_edges;
+    int edges_size;
+    int*rowedges;
+    int*active;
+    int active_size;
+    int*cover;
+    int cover_x1, cover_x2;
 
     internal_result_t*results;
     internal_result_t*result_next;
@@ -92,23 +121,25 @@ typedef struct _fillinfo {
 } fillinfo_t;
 
 
-static inline void add_pixel(internal_t*i, float x, int y)
+static inline void add_edge(internal_t*i, double x, double posx, double stepx, int y1, int y2)
 {
-    renderpoint_t p;
-
-    if(x >= i->width2 || y >= i->height2 || y<0) return;
-    p.x = x;
-    if(y<i->ymin) i->ymin = y;
-    if(y>i->ymax) i->ymax = y;
+    renderedge_t*e;
 
-    renderline_t*l = &i->lines[y];
-
-    if(l->num == l->size) {
-	l->size += 32;
-	l->points = (renderpoint_t*)rfx_realloc(l->points, l->size * sizeof(renderpoint_t));
+    if(i->num_edges == i->edges_size) {
+	i->edges_size = i->edges_size?i->edges_size*2:64;
+	i->edges = (renderedge_t*)rfx_realloc(i->edges, i->edges_size * sizeof(renderedge_t));
     }
-    l->points[l->num] = p;
-    l->num++;
+    e = &i->edges[i->num_edges];
+    e->x = x;
+    e->posx = posx;
+    e->stepx = stepx;
+    e->y1 = y1;
+    e->y2 = y2;
+    e->next = i->rowedges[y1];
+    i->rowedges[y1] = i->num_edges++;
+
+    if(y1<i->ymin) i->ymin = y1;
+    if(y2>i->ymax) i->ymax = y2;
 }
 
 /* set this to 0.777777 or something if the "both fillstyles set while not inside shape"
@@ -155,17 +186,25 @@ static void add_line(gfxdevice_t*dev , double x1, double y1, double x2, double y
     x2 = x2 + (ny2-y2)*stepx;
 
     {
-	int posy=INT(ny1);
-	int endy=INT(ny2);
+	int posy=INT(ny1)-i->yshift;
+	int endy=INT(ny2)-i->yshift;
+	int height=i->height2*i->aa;
 	double posx=0;
-	double startx = x1;
 
-	while(posy<=endy) {
-	    float xx = (float)(startx + posx);
-	    add_pixel(i, xx ,posy);
+	if(endy < 0)
+	    return;
+
+	/* skip the scanlines above the page. x is stepped the same way
+	   fill() steps it, so crossings don't depend on where we start */
+	while(posy<0 && posy<=endy) {
 	    posx+=stepx;
 	    posy++;
 	}
+	if(endy >= height)
+	    endy = height-1;
+	if(posy > endy)
+	    return;
+	add_edge(i, x1, posx, stepx, posy, endy);
     }
 }
 #define PI 3.14159265358979
@@ -256,50 +295,167 @@ static void add_solidline(gfxdevice_t*dev, double x1, double y1, double x2, doub
     add_line(dev, lastx, lasty, (x1+vx), (y1+vy));
 }
 
-static int compare_renderpoints(const void * _a, const void * _b)
+/* blend the premultiplied color col over those of the n (<=32) pixels
+   starting at line whose bit is set in bits */
+typedef void (*blend_func_t)(RGBA*line, U32 bits, int n, RGBA col);
+
+static void blend_bits_c(RGBA*line, U32 bits, int n, RGBA col)
 {
-    renderpoint_t*a = (renderpoint_t*)_a;
-    renderpoint_t*b = (renderpoint_t*)_b;
-    if(a->x < b->x) return -1;
-    if(a->x > b->x) return 1;
-    return 0;
+    int ainv = 255-col.a;
+    int x;
+    for(x=0;x<n;x++) {
+	if(bits&(1<<x)) {
+	    line[x].r = ((line[x].r*ainv)/255)+col.r;
+	    line[x].g = ((line[x].g*ainv)/255)+col.g;
+	    line[x].b = ((line[x].b*ainv)/255)+col.b;
+	    line[x].a = ((line[x].a*ainv)/255)+col.a;
+	}
+    }
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/* computes (p*ainv)/255+col for 16 channels at once, and takes it for
+   the pixels whose mask is set. (v+1+(v>>8))>>8 is exactly v/255 for all
+   v <= 255*255. The addition can't overflow, as col is premultiplied. */
+static inline __m128i blend4_sse2(__m128i p, __m128i mask, __m128i ainv, __m128i col)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi16(1);
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), ainv);
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), ainv);
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+    __m128i r = _mm_add_epi8(_mm_packus_epi16(lo, hi), col);
+    return _mm_or_si128(_mm_and_si128(mask, r), _mm_andnot_si128(mask, p));
+}
+
+static void blend_bits_sse2(RGBA*line, U32 bits, int n, RGBA col)
+{
+    U32 c;
+    memcpy(&c, &col, sizeof(c));
+    __m128i vcol = _mm_set1_epi32(c);
+    __m128i vainv = _mm_set1_epi16(255-col.a);
+    __m128i bitsel = _mm_set_epi32(8,4,2,1);
+    int x;
+    for(x=0;x+4<=n;x+=4) {
+	int b = (bits>>x)&15;
+	if(!b)
+	    continue;
+	__m128i mask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(b), bitsel), bitsel);
+	__m128i p = _mm_loadu_si128((__m128i*)&line[x]);
+	_mm_storeu_si128((__m128i*)&line[x], blend4_sse2(p, mask, vainv, vcol));
+    }
+    if(x<n)
+	blend_bits_c(&line[x], bits>>x, n-x, col);
+}
+#endif
+
+#if defined(__SSE2__) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+
+/* same as blend_bits_sse2, eight pixels at a time. unpack and pack work
+   on the two 128 bit lanes separately, so the pixel order is preserved. */
+__attribute__((target("avx2")))
+static void blend_bits_avx2(RGBA*line, U32 bits, int n, RGBA col)
+{
+    U32 c;
+    memcpy(&c, &col, sizeof(c));
+    __m256i vcol = _mm256_set1_epi32(c);
+    __m256i vainv = _mm256_set1_epi16(255-col.a);
+    __m256i one = _mm256_set1_epi16(1);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i bitsel = _mm256_set_epi32(128,64,32,16,8,4,2,1);
+    int x;
+    for(x=0;x+8<=n;x+=8) {
+	int b = (bits>>x)&255;
+	if(!b)
+	    continue;
+	__m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(b), bitsel), bitsel);
+	__m256i p = _mm256_loadu_si256((__m256i*)&line[x]);
+	__m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(p, zero), vainv);
+	__m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(p, zero), vainv);
+	lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, one), _mm256_srli_epi16(lo, 8)), 8);
+	hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, one), _mm256_srli_epi16(hi, 8)), 8);
+	__m256i r = _mm256_add_epi8(_mm256_packus_epi16(lo, hi), vcol);
+	r = _mm256_or_si256(_mm256_and_si256(mask, r), _mm256_andnot_si256(mask, p));
+	_mm256_storeu_si256((__m256i*)&line[x], r);
+    }
+    if(x<n)
+	blend_bits_sse2(&line[x], bits>>x, n-x, col);
+}
+#endif
+
+static blend_func_t blend_bits = blend_bits_c;
+
+static void init_blend_kernels()
+{
+    /* the first device is created before any band threads are */
+    static char initialized = 0;
+    if(initialized)
+	return;
+    initialized = 1;
+#if defined(HAVE_AVX2_KERNELS)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+	blend_bits = blend_bits_avx2;
+	return;
+    }
+#endif
+#ifdef __SSE2__
+    blend_bits = blend_bits_sse2;
+#endif
+}
+
+/* the clip bits of the n (<=32) pixels starting at x, in the lower bits */
+static inline U32 clip_bits(U32*z, int x, int n)
+{
+    U32 bits = z[x/32] >> (x&31);
+    if(n<32)
+	bits &= (1u<<n)-1;
+    return bits;
 }
 
 static void fill_line_solid(RGBA*line, U32*z, int y, int x1, int x2, RGBA col)
 {
     int x = x1;
 
-    U32 bit = 1<<(x1&31);
-    int bitpos = (x1/32);
+    /* like the other fill_line functions, fill at least one pixel */
+    if(x2 <= x1)
+	x2 = x1+1;
 
     if(col.a!=255) {
-        int ainv = 255-col.a;
         col.r = (col.r*col.a)/255;
         col.g = (col.g*col.a)/255;
         col.b = (col.b*col.a)/255;
-        do {
-	    if(z[bitpos]&bit) {
-		line[x].r = ((line[x].r*ainv)/255)+col.r;
-		line[x].g = ((line[x].g*ainv)/255)+col.g;
-		line[x].b = ((line[x].b*ainv)/255)+col.b;
-		//line[x].a = 255;
-		line[x].a = ((line[x].a*ainv)/255)+col.a;
-	    }
-	    bit <<= 1;
-	    if(!bit) {
-		bit = 1;bitpos++;
-	    }
-        } while(++x<x2);
-    } else {
-        do {
-	    if(z[bitpos]&bit) {
-		line[x] = col;
-	    }
-	    bit <<= 1;
-	    if(!bit) {
-		bit = 1;bitpos++;
+    }
+
+    /* process the span in pieces which don't cross a clip word, so that
+       fully clipped or fully visible pieces can be handled at once */
+    while(x<x2) {
+	int n = 32-(x&31);
+	if(n > x2-x)
+	    n = x2-x;
+	U32 bits = clip_bits(z, x, n);
+	if(bits) {
+	    if(col.a!=255) {
+		blend_bits(&line[x], bits, n, col);
+	    } else if(bits == (n<32?(1u<<n)-1:0xffffffff)) {
+		RGBA*l = &line[x];
+		int t;
+		for(t=0;t<n;t++)
+		    l[t] = col;
+	    } else {
+		int t;
+		for(t=0;t<n;t++) {
+		    if(bits&(1u<<t))
+			line[x+t] = col;
+		}
 	    }
-        } while(++x<x2);
+	}
+	x += n;
     }
 }
 
@@ -331,6 +487,12 @@ static void fill_line_bitmap(RGBA*line, U32*z, int y, int x1, int x2, fillinfo_t
     int bitpos = (x1/32);
 
     do {
+	if(bit == 1 && !z[bitpos] && x+31 < x2) {
+	    /* the next 32 pixels are all clipped */
+	    x += 31;
+	    bitpos++;
+	    continue;
+	}
 	if(z[bitpos]&bit) {
 	    RGBA col;
 	    int xx = (int)(xx1 + x * xinc1);
@@ -388,6 +550,12 @@ static void fill_line_gradient(RGBA*line, U32*z, int y, int x1, int x2, fillinfo
     int bitpos = (x1/32);
 
     do {
+	if(bit == 1 && !z[bitpos] && x+31 < x2) {
+	    /* the next 32 pixels are all clipped */
+	    x += 31;
+	    bitpos++;
+	    continue;
+	}
 	if(z[bitpos]&bit) {
 	    RGBA col;
 	    int ainv;
@@ -423,18 +591,23 @@ static void fill_line_gradient(RGBA*line, U32*z, int y, int x1, int x2, fillinfo
 
 static void fill_line_clip(RGBA*line, U32*z, int y, int x1, int x2)
 {
-    int x = x1;
+    if(x2 <= x1)
+	x2 = x1+1;
 
-    U32 bit = 1<<(x1&31);
-    int bitpos = (x1/32);
+    int b1 = x1/32;
+    int b2 = (x2-1)/32;
+    U32 m1 = 0xffffffff << (x1&31);
+    U32 m2 = 0xffffffff >> (31-((x2-1)&31));
 
-    do {
-	z[bitpos]|=bit;
-	bit <<= 1;
-	if(!bit) {
-	    bit = 1;bitpos++;
-	}
-    } while(++x<x2);
+    if(b1 == b2) {
+	z[b1] |= m1&m2;
+    } else {
+	int b;
+	z[b1] |= m1;
+	for(b=b1+1;b<b2;b++)
+	    z[b] = 0xffffffff;
+	z[b2] |= m2;
+    }
 }
 
 void fill_line(gfxdevice_t*dev, RGBA*line, U32*zline, int y, int startx, int endx, fillinfo_t*fill)
@@ -449,51 +622,254 @@ void fill_line(gfxdevice_t*dev, RGBA*line, U32*zline, int y, int startx, int end
 	fill_line_gradient(line, zline, y, startx, endx, fill);
 }
 
+static void fill_row(gfxdevice_t*dev, int y, int num, fillinfo_t*fill)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    RGBA*line = &i->img[i->width2*y];
+    U32*zline = &i->clipbuf->data[i->bitwidth*y];
+    int n;
+
+    for(n=0;n<num;n++) {
+        int startx = i->edges[i->active[n]].cur;
+        int endx = n<num-1?i->edges[i->active[n+1]].cur:i->width2;
+        if(endx > i->width2)
+            endx = i->width2;
+        if(startx < 0)
+            startx = 0;
+        if(endx < 0)
+            endx = 0;
+
+        if(!(n&1))
+            fill_line(dev, line, zline, y+i->yshift, startx, endx, fill);
+
+        if(endx == i->width2)
+            break;
+    }
+    if(fill->type == filltype_clip) {
+        if(i->clipbuf->next) {
+            U32*line2 = &i->clipbuf->next->data[i->bitwidth*y];
+            int x;
+            for(x=0;x<i->bitwidth;x++)
+                zline[x] &= line2[x];
+        }
+    }
+}
+
+/* coverage mode: add the subpixels from a to b (exclusive) of one
+   subscanline to the coverage counts of the pixels they fall into */
+static void add_coverage(internal_t*i, int a, int b)
+{
+    int aa = i->aa;
+    int pa = a/aa;
+    int pb = b/aa;
+
+    if(a >= b)
+        return;
+    if(pa < i->cover_x1) i->cover_x1 = pa;
+    if(pb > i->cover_x2) i->cover_x2 = pb;
+
+    if(pa == pb) {
+        i->cover[pa] += b-a;
+        return;
+    }
+    i->cover[pa] += (pa+1)*aa - a;
+    for(pa++;pa<pb;pa++)
+        i->cover[pa] += aa;
+    i->cover[pb] += b - pb*aa;
+}
+
+static inline int fill_color(fillinfo_t*info, double det, double x, double y, RGBA*col)
+{
+    gfxmatrix_t*m = info->matrix;
+    if(info->type == filltype_solid) {
+        *col = *info->color;
+        col->r = (col->r*col->a)/255;
+        col->g = (col->g*col->a)/255;
+        col->b = (col->b*col->a)/255;
+        return 1;
+    }
+    double u = ( (x - m->tx) * m->m11 - (y - m->ty) * m->m10) * det;
+    double v = (-(x - m->tx) * m->m01 + (y - m->ty) * m->m00) * det;
+    if(info->type == filltype_bitmap) {
+        gfximage_t*b = info->image;
+        int xx = (int)u;
+        int yy = (int)v;
+        if(info->linear_or_radial) {
+            if(xx<0) xx=0;
+            if(xx>=b->width) xx = b->width-1;
+            if(yy<0) yy=0;
+            if(yy>=b->height) yy = b->height-1;
+        } else {
+            xx %= b->width;
+            yy %= b->height;
+            if(xx<0) xx += b->width;
+            if(yy<0) yy += b->height;
+        }
+        *col = b->data[yy*b->width+xx];
+        return 1;
+    } else if(info->type == filltype_gradient) {
+        int pos;
+        if(info->linear_or_radial) {
+            double r = sqrt(u*u + v*v);
+            if(r>1) r = 1;
+            pos = (int)(r*255.999);
+        } else {
+            double r = u;
+            if(r>1) r = 1;
+            if(r<-1) r = -1;
+            pos = (int)((r+1)*127.999);
+        }
+        *col = info->gradient[pos];
+        return 1;
+    }
+    return 0;
+}
+
+/* coverage mode: blend the accumulated coverage of pixel row y into the
+   image (or, for clip fills, set the pixels which are at least half covered) */
+static void flush_coverage(gfxdevice_t*dev, int y, fillinfo_t*fill)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    RGBA*line = &i->img[i->width2*y];
+    U32*zline = &i->clipbuf->data[i->bitwidth*y];
+    int q = i->aa*i->aa;
+    int x1 = i->cover_x1;
+    int x2 = i->cover_x2;
+    double det = 1.0;
+    int x;
+
+    if(fill->type == filltype_bitmap || fill->type == filltype_gradient) {
+        gfxmatrix_t*m = fill->matrix;
+        det = m->m00*m->m11 - m->m01*m->m10;
+        if(fabs(det) < 0.0005)
+            x2 = x1-1;
+        else
+            det = 1.0/det;
+    }
+    if(fill->type == filltype_bitmap && 
+       (!fill->image || !fill->image->width || !fill->image->height)) {
+        static gfxcolor_t red = {255,255,0,0};
+        fill->type = filltype_solid;
+        fill->color = &red;
+    }
+    if(x2 >= i->width2)
+        x2 = i->width2-1;
+
+    for(x=x1;x<=x2;x++) {
+        int c = i->cover[x];
+        U32 bit = 1<<(x&31);
+        RGBA col;
+        int ainv;
+        if(!c)
+            continue;
+        i->cover[x] = 0;
+        if(fill->type == filltype_clip) {
+            if(c*2 >= q)
+                zline[x/32] |= bit;
+            continue;
+        }
+        if(!(zline[x/32]&bit) ||
+           !fill_color(fill, det, (x+0.5)*i->aa, (y+0.5)*i->aa+i->yshift, &col))
+            continue;
+
+        /* col has premultiplied alpha */
+        ainv = 255-(col.a*c)/q;
+        line[x].r = ((line[x].r*ainv)/255)+(col.r*c)/q;
+        line[x].g = ((line[x].g*ainv)/255)+(col.g*c)/q;
+        line[x].b = ((line[x].b*ainv)/255)+(col.b*c)/q;
+        line[x].a = ((line[x].a*ainv)/255)+(col.a*c)/q;
+    }
+    for(;x<=i->cover_x2;x++)
+        i->cover[x] = 0;
+    i->cover_x1 = 0x7fffffff;
+    i->cover_x2 = -1;
+
+    if(fill->type == filltype_clip) {
+        if(i->clipbuf->next) {
+            U32*line2 = &i->clipbuf->next->data[i->bitwidth*y];
+            for(x=0;x<i->bitwidth;x++)
+                zline[x] &= line2[x];
+        }
+    }
+}
+
+static void fill_row_coverage(gfxdevice_t*dev, int y, int num, fillinfo_t*fill)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    int width = i->width2*i->aa;
+    int n;
+
+    for(n=0;n<num;n+=2) {
+        int startx = i->edges[i->active[n]].cur;
+        int endx = n<num-1?i->edges[i->active[n+1]].cur:width;
+        if(endx > width)
+            endx = width;
+        if(startx < 0)
+            startx = 0;
+        add_coverage(i, startx, endx);
+    }
+    if((y+1)%i->aa == 0 || y == i->ymax)
+        flush_coverage(dev, y/i->aa, fill);
+}
+
+/* fill the edges collected by add_line, using even-odd rule. Walks the
+   scanlines from top to bottom, keeping the edges which cross the current
+   scanline in an active edge table which is sorted by x. */
 void fill(gfxdevice_t*dev, fillinfo_t*fill)
 {
     internal_t*i = (internal_t*)dev->internal;
+    int width = i->width2*i->aa;
+    int num_active = 0;
     int y;
-    U32 clipdepth = 0;
+
+    if(i->active_size < i->num_edges) {
+        i->active_size = i->num_edges;
+        i->active = (int*)rfx_realloc(i->active, i->active_size*sizeof(int));
+    }
+
     for(y=i->ymin;y<=i->ymax;y++) {
-	renderpoint_t*points = i->lines[y].points;
-        RGBA*line = &i->img[i->width2*y];
-        U32*zline = &i->clipbuf->data[i->bitwidth*y];
-
-	int n;
-	int num = i->lines[y].num;
-	int lastx;
-        qsort(points, num, sizeof(renderpoint_t), compare_renderpoints);
-
-        for(n=0;n<num;n++) {
-            renderpoint_t*p = &points[n];
-            renderpoint_t*next= n<num-1?&points[n+1]:0;
-            int startx = p->x;
-            int endx = next?next->x:i->width2;
-            if(endx > i->width2)
-                endx = i->width2;
-            if(startx < 0)
-                startx = 0;
-            if(endx < 0)
-                endx = 0;
-
-	    if(!(n&1))
-		fill_line(dev, line, zline, y, startx, endx, fill);
-
-	    lastx = endx;
-            if(endx == i->width2)
-                break;
+        int*active = i->active;
+        int e,n,m,num;
+
+        for(e=i->rowedges[y];e>=0;e=i->edges[e].next)
+            active[num_active++] = e;
+        i->rowedges[y] = -1;
+
+        /* the order of the crossings rarely changes from one scanline to
+           the next, so insertion sort is close to linear here */
+        for(n=0;n<num_active;n++) {
+            e = active[n];
+            renderedge_t*edge = &i->edges[e];
+            float x = (float)(edge->x + edge->posx);
+            edge->cur = x;
+            for(m=n;m>0 && i->edges[active[m-1]].cur > x;m--)
+                active[m] = active[m-1];
+            active[m] = e;
         }
-	if(fill->type == filltype_clip) {
-	    if(i->clipbuf->next) {
-		U32*line2 = &i->clipbuf->next->data[i->bitwidth*y];
-		int x;
-		for(x=0;x<i->bitwidth;x++)
-		    zline[x] &= line2[x];
-	    }
-	}
 
-	i->lines[y].num = 0;
+        /* crossings right of the page are ignored */
+        num = num_active;
+        while(num && i->edges[active[num-1]].cur >= width)
+            num--;
+
+        if(i->aa>1)
+            fill_row_coverage(dev, y, num, fill);
+        else
+            fill_row(dev, y, num, fill);
+
+        for(n=0,m=0;n<num_active;n++) {
+            renderedge_t*edge = &i->edges[active[n]];
+            if(edge->y2 > y) {
+                edge->posx += edge->stepx;
+                active[m++] = active[n];
+            }
+        }
+        num_active = m;
     }
+
+    i->num_edges = 0;
+    i->ymin = 0x7fffffff;
+    i->ymax = -0x80000000;
 }
 
 void fill_solid(gfxdevice_t*dev, gfxcolor_t* color)
@@ -517,6 +893,15 @@ int render_setparameter(struct _gfxdevice*dev, const char*key, const char*value)
 	i->zoom = i->antialize * i->multiply;
 	fprintf(stderr, "Warning: multiply not implemented yet\n");
 	return 1;
+    } else if(!strcmp(key, "coverage")) {
+	i->coverage = atoi(value);
+	return 1;
+    } else if(!strcmp(key, "threads")) {
+	i->threads = atoi(value);
+	return 1;
+    } else if(!strcmp(key, "bandheight")) {
+	i->bandheight = atoi(value);
+	return 1;
     } else if(!strcmp(key, "fillwhite")) {
 	i->fillwhite = atoi(value);
 	return 1;
@@ -555,10 +940,36 @@ void endclip(struct _gfxdevice*dev, char removelast)
     free(c);
 }
 
+/* for band devices: is the (unzoomed) y range y1..y2 entirely above or
+   below the scanlines of this band? Shapes which are are skipped before
+   their edges are generated. */
+static char outside_band(internal_t*i, double y1, double y2)
+{
+    if(!i->band_rows)
+	return 0;
+    /* one scanline of tolerance on both sides */
+    return y2*i->zoom < i->yshift - 1 ||
+	   y1*i->zoom > i->yshift + i->height*i->antialize + 1;
+}
+static char line_outside_band(internal_t*i, gfxline_t*line, double margin)
+{
+    if(!i->band_rows)
+	return 0;
+    gfxbbox_t bbox = gfxline_getbbox(line);
+    return outside_band(i, bbox.ymin - margin, bbox.ymax + margin);
+}
+
 void render_stroke(struct _gfxdevice*dev, gfxline_t*line, gfxcoord_t width, gfxcolor_t*color, gfx_capType cap_style, gfx_joinType joint_style, gfxcoord_t miterLimit)
 {
     internal_t*i = (internal_t*)dev->internal;
     double x,y;
+
+    if(i->record) {
+	i->record->stroke(i->record, line, width, color, cap_style, joint_style, miterLimit);
+	return;
+    }
+    if(line_outside_band(i, line, width))
+	return;
     
     /*if(cap_style != gfx_capRound || joint_style != gfx_joinRound) {
 	fprintf(stderr, "Warning: cap/joint style != round not yet supported\n");
@@ -651,6 +1062,10 @@ void render_startclip(struct _gfxdevice*dev, gfxline_t*line)
 {
     internal_t*i = (internal_t*)dev->internal;
     fillinfo_t info;
+    if(i->record) {
+	i->record->startclip(i->record, line);
+	return;
+    }
     memset(&info, 0, sizeof(info));
     newclip(dev);
     info.type = filltype_clip;
@@ -661,12 +1076,22 @@ void render_startclip(struct _gfxdevice*dev, gfxline_t*line)
 void render_endclip(struct _gfxdevice*dev)
 {
     internal_t*i = (internal_t*)dev->internal;
+    if(i->record) {
+	i->record->endclip(i->record);
+	return;
+    }
     endclip(dev, 0);
 }
 
 void render_fill(struct _gfxdevice*dev, gfxline_t*line, gfxcolor_t*color)
 {
     internal_t*i = (internal_t*)dev->internal;
+    if(i->record) {
+	i->record->fill(i->record, line, color);
+	return;
+    }
+    if(line_outside_band(i, line, 0))
+	return;
 
     draw_line(dev, line);
     fill_solid(dev, color);
@@ -675,6 +1100,12 @@ void render_fill(struct _gfxdevice*dev, gfxline_t*line, gfxcolor_t*color)
 void render_fillbitmap(struct _gfxdevice*dev, gfxline_t*line, gfximage_t*img, gfxmatrix_t*matrix, gfxcxform_t*cxform)
 {
     internal_t*i = (internal_t*)dev->internal;
+    if(i->record) {
+	i->record->fillbitmap(i->record, line, img, matrix, cxform);
+	return;
+    }
+    if(line_outside_band(i, line, 0))
+	return;
 
     gfxmatrix_t m2 = *matrix;
 
@@ -696,6 +1127,12 @@ void render_fillbitmap(struct _gfxdevice*dev, gfxline_t*line, gfximage_t*img, gf
 void render_fillgradient(struct _gfxdevice*dev, gfxline_t*line, gfxgradient_t*gradient, gfxgradienttype_t type, gfxmatrix_t*matrix)
 {
     internal_t*i = (internal_t*)dev->internal;
+    if(i->record) {
+	i->record->fillgradient(i->record, line, gradient, type, matrix);
+	return;
+    }
+    if(line_outside_band(i, line, 0))
+	return;
     
     gfxmatrix_t m2 = *matrix;
 
@@ -753,6 +1190,10 @@ void render_fillgradient(struct _gfxdevice*dev, gfxline_t*line, gfxgradient_t*gr
 
 void render_addfont(struct _gfxdevice*dev, gfxfont_t*font)
 {
+    internal_t*i = (internal_t*)dev->internal;
+    if(i->record) {
+	i->record->addfont(i->record, font);
+    }
 }
 
 void render_drawchar(struct _gfxdevice*dev, gfxfont_t*font, int glyphnr, gfxcolor_t*color, gfxmatrix_t*matrix)
@@ -760,12 +1201,28 @@ void render_drawchar(struct _gfxdevice*dev, gfxfont_t*font, int glyphnr, gfxcolo
     internal_t*i = (internal_t*)dev->internal;
     if(!font)
 	return;
+    if(i->record) {
+	i->record->drawchar(i->record, font, glyphnr, color, matrix);
+	return;
+    }
 
     /* align characters to whole pixels */
     matrix->tx = (int)(matrix->tx * i->antialize) / i->antialize;
     matrix->ty = (int)(matrix->ty * i->antialize) / i->antialize;
 
     gfxglyph_t*glyph = &font->glyphs[glyphnr];
+    if(i->band_rows) {
+	gfxbbox_t b = gfxline_getbbox(glyph->line);
+	double y1 = matrix->m01*b.xmin + matrix->m11*b.ymin;
+	double y2 = matrix->m01*b.xmax + matrix->m11*b.ymin;
+	double y3 = matrix->m01*b.xmin + matrix->m11*b.ymax;
+	double y4 = matrix->m01*b.xmax + matrix->m11*b.ymax;
+	double ymin = y1<y2?y1:y2, ymax = y1>y2?y1:y2;
+	if(y3<ymin) ymin = y3; if(y3>ymax) ymax = y3;
+	if(y4<ymin) ymin = y4; if(y4>ymax) ymax = y4;
+	if(outside_band(i, ymin + matrix->ty, ymax + matrix->ty))
+	    return;
+    }
     gfxline_t*line2 = gfxline_clone(glyph->line);
     gfxline_transform(line2, matrix);
     draw_line(dev, line2);
@@ -896,6 +1353,8 @@ gfxresult_t* render_finish(struct _gfxdevice*dev)
     res->get = render_result_get;
     res->destroy = render_result_destroy;
 
+    if(i->edges) {rfx_free(i->edges);i->edges = 0;}
+    if(i->active) {rfx_free(i->active);i->active = 0;}
     free(dev->internal); dev->internal = 0; i = 0;
 
     return res;
@@ -906,22 +1365,45 @@ void render_startpage(struct _gfxdevice*dev, int width, int height)
     internal_t*i = (internal_t*)dev->internal;
     int y;
 
-    if(i->width2 || i->height2) {
+    if(i->width2 || i->height2 || i->record) {
 	fprintf(stderr, "Error: startpage() called twice (no endpage()?)\n");
 	exit(1);
     }
+
+    if(i->threads > 1 || i->bandheight > 0) {
+	/* tiled mode- only record the page, it's rasterized in endpage() */
+	i->page_width = width;
+	i->page_height = height;
+	i->width = width*i->multiply;
+	i->height = height*i->multiply;
+	i->record = (gfxdevice_t*)rfx_calloc(sizeof(gfxdevice_t));
+	gfxdevice_record_init(i->record, 0);
+	gfxdevice_record_set_font_references(i->record, 1);
+	return;
+    }
     
+    /* in coverage mode, edges are kept in subpixel coordinates, but
+       the image is only allocated in the final resolution */
+    i->aa = (i->coverage && i->antialize > 1) ? i->antialize : 1;
+
     i->width = width*i->multiply;
     i->height = height*i->multiply;
-    i->width2 = width*i->zoom;
-    i->height2 = height*i->zoom;
+    if(i->band_rows) {
+	i->height = i->band_rows;
+	i->yshift = i->band_y*i->antialize;
+    }
+    i->width2 = width*i->zoom/i->aa;
+    i->height2 = i->height*i->antialize/i->aa;
     i->bitwidth = (i->width2+31)/32;
 
-    i->lines = (renderline_t*)rfx_alloc(i->height2*sizeof(renderline_t));
-    for(y=0;y<i->height2;y++) {
-	memset(&i->lines[y], 0, sizeof(renderline_t));
-        i->lines[y].points = 0;
-        i->lines[y].num = 0;
+    i->rowedges = (int*)rfx_alloc(i->height2*i->aa*sizeof(int));
+    for(y=0;y<i->height2*i->aa;y++) {
+        i->rowedges[y] = -1;
+    }
+    if(i->aa > 1) {
+        i->cover = (int*)rfx_calloc((i->width2+1)*sizeof(int));
+        i->cover_x1 = 0x7fffffff;
+        i->cover_x2 = -1;
     }
     i->img = (RGBA*)rfx_calloc(sizeof(RGBA)*i->width2*i->height2);
     if(i->fillwhite) {
@@ -937,15 +1419,10 @@ void render_startpage(struct _gfxdevice*dev, int width, int height)
     memset(i->clipbuf->data, 255, sizeof(U32)*i->bitwidth*i->height2);
 }
 
-static void store_image(internal_t*i, internal_result_t*ir)
+/* downsample the page into dest, which has i->width*i->height pixels */
+static void store_image(internal_t*i, gfxcolor_t*dest)
 {
-    ir->img.data = (gfxcolor_t*)malloc(i->width*i->height*sizeof(gfxcolor_t));
-    ir->img.width = i->width;
-    ir->img.height = i->height;
-
-    gfxcolor_t*dest = ir->img.data;
-
-    if(i->antialize <= 1) /* no antializing */ {
+    if(i->antialize <= 1 || i->aa > 1) /* no antializing, or already done */ {
 	int y;
 	for(y=0;y<i->height;y++) {
 	    RGBA*line = &i->img[y*i->width];
@@ -991,14 +1468,10 @@ static void store_image(internal_t*i, internal_result_t*ir)
     }
 }
 
-void render_endpage(struct _gfxdevice*dev)
+/* close the current page, and store its image in dest */
+static void end_page(gfxdevice_t*dev, gfxcolor_t*dest)
 {
     internal_t*i = (internal_t*)dev->internal;
-    
-    if(!i->width2 || !i->height2) {
-	fprintf(stderr, "Error: endpage() called without corresponding startpage()\n");
-	exit(1);
-    }
 
     endclip(dev, 1);
     int unclosed = 0;
@@ -1010,13 +1483,25 @@ void render_endpage(struct _gfxdevice*dev)
     if(unclosed) {
         fprintf(stderr, "Warning: %d unclosed clip(s) while processing endpage()\n", unclosed);
     }
-    
-    internal_result_t*ir= (internal_result_t*)rfx_calloc(sizeof(internal_result_t));
-    ir->palette = i->palette;
 
-    int y,x;
+    store_image(i, dest);
+
+    rfx_free(i->rowedges);i->rowedges=0;
+    if(i->cover) {rfx_free(i->cover);i->cover = 0;}
+
+    if(i->img) {rfx_free(i->img);i->img = 0;}
 
-    store_image(i, ir);
+    i->width2 = 0;
+    i->height2 = 0;
+}
+
+static internal_result_t* add_result(internal_t*i)
+{
+    internal_result_t*ir= (internal_result_t*)rfx_calloc(sizeof(internal_result_t));
+    ir->palette = i->palette;
+    ir->img.data = (gfxcolor_t*)malloc(i->width*i->height*sizeof(gfxcolor_t));
+    ir->img.width = i->width;
+    ir->img.height = i->height;
 
     ir->next = 0;
     if(i->result_next) {
@@ -1026,16 +1511,125 @@ void render_endpage(struct _gfxdevice*dev)
 	i->results = ir;
     }
     i->result_next = ir;
+    return ir;
+}
+
+#define DEFAULT_BANDHEIGHT 64
+
+typedef struct _bandqueue {
+    internal_t*page;
+    gfxresult_t*recording;
+    gfxcolor_t*dest;
+    int bandheight;
+    int num_bands;
+    int next;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t mutex;
+#endif
+} bandqueue_t;
 
-    for(y=0;y<i->height2;y++) {
-	rfx_free(i->lines[y].points); i->lines[y].points = 0;
+/* rasterize one band of a recorded page, with a render device of its own
+   which only allocates (and supersamples) the rows of this band */
+static void render_band(bandqueue_t*q, int nr)
+{
+    internal_t*page = q->page;
+    gfxdevice_t band;
+    int y = nr*q->bandheight;
+    int rows = page->height - y;
+    if(rows > q->bandheight)
+	rows = q->bandheight;
+
+    gfxdevice_render_init(&band);
+    internal_t*i = (internal_t*)band.internal;
+    i->antialize = page->antialize;
+    i->multiply = page->multiply;
+    i->zoom = page->zoom;
+    i->fillwhite = page->fillwhite;
+    i->coverage = page->coverage;
+    i->band_y = y;
+    i->band_rows = rows;
+
+    band.startpage(&band, page->page_width, page->page_height);
+    gfxresult_record_replay(q->recording, &band, 0);
+    end_page(&band, &q->dest[y*page->width]);
+
+    gfxresult_t*r = band.finish(&band);
+    r->destroy(r);
+}
+
+static void* band_thread(void*_q)
+{
+    bandqueue_t*q = (bandqueue_t*)_q;
+    while(1) {
+	int nr;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_lock(&q->mutex);
+#endif
+	nr = q->next++;
+#ifdef HAVE_PTHREADS
+	pthread_mutex_unlock(&q->mutex);
+#endif
+	if(nr >= q->num_bands)
+	    break;
+	render_band(q, nr);
     }
-    rfx_free(i->lines);i->lines=0;
+    return 0;
+}
 
-    if(i->img) {rfx_free(i->img);i->img = 0;}
+static void render_tiled_endpage(gfxdevice_t*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    int num_threads = i->threads > 1 ? i->threads : 1;
+    bandqueue_t q;
+
+    memset(&q, 0, sizeof(q));
+    q.page = i;
+    q.recording = i->record->finish(i->record);
+    rfx_free(i->record);i->record = 0;
+    q.bandheight = i->bandheight > 0 ? i->bandheight : DEFAULT_BANDHEIGHT;
+    q.num_bands = (i->height + q.bandheight - 1) / q.bandheight;
+    q.dest = add_result(i)->img.data;
+
+#ifdef HAVE_PTHREADS
+    pthread_mutex_init(&q.mutex, 0);
+    if(num_threads > q.num_bands)
+	num_threads = q.num_bands;
+    if(num_threads > 1) {
+	pthread_t*threads = (pthread_t*)rfx_calloc(sizeof(pthread_t)*num_threads);
+	int t;
+	for(t=1;t<num_threads;t++)
+	    pthread_create(&threads[t], 0, band_thread, &q);
+	band_thread(&q);
+	for(t=1;t<num_threads;t++)
+	    pthread_join(threads[t], 0);
+	rfx_free(threads);
+    } else {
+	band_thread(&q);
+    }
+    pthread_mutex_destroy(&q.mutex);
+#else
+    band_thread(&q);
+#endif
 
-    i->width2 = 0;
-    i->height2 = 0;
+    q.recording->destroy(q.recording);
+}
+
+void render_endpage(struct _gfxdevice*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+
+    if(i->record) {
+	render_tiled_endpage(dev);
+	return;
+    }
+    
+    if(!i->width2 || !i->height2) {
+	fprintf(stderr, "Error: endpage() called without corresponding startpage()\n");
+	exit(1);
+    }
+
+    internal_result_t*ir = add_result(i);
+    end_page(dev, ir->img.data);
 }
 
 void render_drawlink(struct _gfxdevice*dev, gfxline_t*line, const char*action, const char*text)
@@ -1059,6 +1653,9 @@ void gfxdevice_render_init(gfxdevice_t*dev)
     i->antialize = 1;
     i->multiply = 1;
     i->zoom = 1;
+    i->aa = 1;
+
+    init_blend_kernels();
 
     dev->setparameter = render_setparameter;
     dev->startpage = render_startpage;
@@ -29,6 +29,17 @@
 extern "C" {
 #endif
 
+/* A device which rasterizes pages into RGBA images.
+
+   Parameters:
+     antialize=N    supersample N*N times
+     coverage=1     anti-alias by accumulating per-pixel coverage instead of
+                    rendering into an N*N times larger image
+     fillwhite=1    start with a white instead of a transparent page
+     threads=N      record each page, then rasterize it in bands on N threads
+     bandheight=H   record each page, then rasterize it in bands of H rows,
+                    which bounds the size of the supersampled buffers
+*/
 void gfxdevice_render_init(gfxdevice_t*);
 gfxdevice_t* gfxdevice_render_new();
 
@@ -29,40 +29,72 @@
 #include "../gfxdevice.h"
 #include "../gfxtools.h"
 #include "../utf8.h"
+#include "../bitio.h"
 
-typedef struct _textpage {
+/* the text of all pages, in one buffer. pages[n] is the offset at which
+   page n starts. */
+typedef struct _textbuffer {
     char*text;
     int textsize;
     int textpos;
-    struct _textpage*next;
-} textpage_t;
+    int*pages;
+    int num_pages;
+    int pages_size;
+} textbuffer_t;
 
 typedef struct _internal {
-    textpage_t*first_page;
-    textpage_t*current_page;
+    textbuffer_t*buf;
     double currentx;
     double currenty;
     double lastadvance;
+
+    /* streaming mode: pages are written here in text_endpage, and
+       only the current page is kept in buf */
+    writer_t*writer;
+    writer_t fdwriter;
+    char formfeed;
+    int pages_written;
 } internal_t;
 
+static textbuffer_t* textbuffer_new()
+{
+    textbuffer_t*buf = (textbuffer_t*)rfx_calloc(sizeof(textbuffer_t));
+    buf->textsize = 4096;
+    buf->text = (char*)malloc(buf->textsize);
+    buf->pages_size = 16;
+    buf->pages = (int*)malloc(sizeof(int)*buf->pages_size);
+    return buf;
+}
+static void textbuffer_destroy(textbuffer_t*buf)
+{
+    free(buf->text);
+    free(buf->pages);
+    free(buf);
+}
+static int textbuffer_pagelength(textbuffer_t*buf, int pagenr)
+{
+    int end = pagenr+1 < buf->num_pages ? buf->pages[pagenr+1] : buf->textpos;
+    return end - buf->pages[pagenr];
+}
+
 int text_setparameter(gfxdevice_t*dev, const char*key, const char*value)
 {
     internal_t*i = (internal_t*)dev->internal;
+    if(!strcmp(key, "formfeed")) {
+	i->formfeed = atoi(value);
+	return 1;
+    }
     return 0;
 }
 void text_startpage(gfxdevice_t*dev, int width, int height)
 {
     internal_t*i = (internal_t*)dev->internal;
-    if(!i->first_page) {
-	i->first_page = i->current_page = (textpage_t*)malloc(sizeof(textpage_t));
-    } else {
-	i->current_page->next = (textpage_t*)malloc(sizeof(textpage_t));
-	i->current_page = i->current_page->next;
+    textbuffer_t*buf = i->buf;
+    if(buf->num_pages == buf->pages_size) {
+	buf->pages_size *= 2;
+	buf->pages = (int*)rfx_realloc(buf->pages, sizeof(int)*buf->pages_size);
     }
-    i->current_page->textsize = 4096;
-    i->current_page->text = (char*)malloc(i->current_page->textsize);
-    i->current_page->textpos = 0;
-    i->current_page->next = 0;
+    buf->pages[buf->num_pages++] = buf->textpos;
     i->currentx = 0;
     i->currenty = 0;
     i->lastadvance = 0;
@@ -96,15 +128,16 @@ void text_addfont(gfxdevice_t*dev, gfxfont_t*font) {}
 static void addchar(gfxdevice_t*dev, int unicode)
 {
     internal_t*i = (internal_t*)dev->internal;
-    if(!i->current_page) {
+    textbuffer_t*buf = i->buf;
+    if(!buf->num_pages) {
         text_startpage(dev, 0, 0);
     }
-    if(i->current_page->textpos + 10 > i->current_page->textsize) {
-	i->current_page->textsize += 4096;
-	i->current_page->text = realloc(i->current_page->text, i->current_page->textsize);
+    if(buf->textpos + 10 > buf->textsize) {
+	buf->textsize *= 2;
+	buf->text = (char*)rfx_realloc(buf->text, buf->textsize);
     }
-    writeUTF8(unicode, &i->current_page->text[i->current_page->textpos]);
-    i->current_page->textpos += strlen(&i->current_page->text[i->current_page->textpos]);
+    writeUTF8(unicode, &buf->text[buf->textpos]);
+    buf->textpos += strlen(&buf->text[buf->textpos]);
 }
 
 void text_drawchar(gfxdevice_t*dev, gfxfont_t*font, int glyphnr, gfxcolor_t*color, gfxmatrix_t*matrix)
@@ -138,85 +171,120 @@ void text_drawlink(gfxdevice_t*dev, gfxline_t*line, const char*action, const cha
     internal_t*i = (internal_t*)dev->internal;
 }
 
+static void flushpage(gfxdevice_t*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    textbuffer_t*buf = i->buf;
+    if(i->formfeed && i->pages_written) {
+	writer_writeU8(i->writer, 12);
+    }
+    i->writer->write(i->writer, buf->text, buf->textpos);
+    buf->textpos = 0;
+    buf->num_pages = 0;
+    i->pages_written++;
+}
+
 void text_endpage(gfxdevice_t*dev)
 {
     internal_t*i = (internal_t*)dev->internal;
+    if(i->writer && i->buf->num_pages) {
+	flushpage(dev);
+    }
 }
 
 void text_result_write(gfxresult_t*r, int filedesc)
 {
-    textpage_t*i= (textpage_t*)r->internal;
+    textbuffer_t*buf = (textbuffer_t*)r->internal;
+    if(buf)
+	write(filedesc, buf->text, buf->textpos);
 }
 int text_result_save(gfxresult_t*r, const char*filename)
 {
-    textpage_t*i= (textpage_t*)r->internal;
-    if(!i) {
+    textbuffer_t*buf = (textbuffer_t*)r->internal;
+    if(!buf || !buf->num_pages) {
 	return 0; // no pages drawn
     }
     FILE*fi = fopen(filename, "wb");
     if(!fi)
 	return 0;
-    while(i) {
-	fwrite(i->text, i->textpos, 1, fi);
-	i = i->next;
-    }
+    fwrite(buf->text, buf->textpos, 1, fi);
     fclose(fi);
     return 1;
 }
 void*text_result_get(gfxresult_t*r, const char*name)
 {
-    textpage_t*i= (textpage_t*)r->internal;
+    textbuffer_t*buf = (textbuffer_t*)r->internal;
+    if(!buf)
+	return 0;
     if(!strcmp(name,"text")) {
-	textpage_t*j = i;
-	int len = 0;
-	while(j) {
-	    len += i->textpos;
-	    j = j->next;
-	}
-	char*text = (char*)malloc(len);
-	int pos = 0;
-	j = i;
-	while(j) {
-	    memcpy(&text[pos], i->text, i->textpos);
-	    pos += i->textpos;
-	    j = j->next;
-	}
-	text[pos] = 0;
+	char*text = (char*)malloc(buf->textpos+1);
+	memcpy(text, buf->text, buf->textpos);
+	text[buf->textpos] = 0;
 	return text;
     } else if(!strncmp(name,"page",4)) {
 	int pagenr = atoi(&name[4]);
 	if(pagenr<0)
 	    pagenr=0;
-	while(pagenr>0) {
-	    i = i->next;
-	    if(!i)
-		return 0;
-	}
-	i->text[i->textpos] = 0;
-	return strdup(i->text);
+	if(pagenr >= buf->num_pages)
+	    return 0;
+	int len = textbuffer_pagelength(buf, pagenr);
+	char*text = (char*)malloc(len+1);
+	memcpy(text, &buf->text[buf->pages[pagenr]], len);
+	text[len] = 0;
+	return text;
     }
     return 0;
 }
 void text_result_destroy(gfxresult_t*r)
 {
-    textpage_t*i= (textpage_t*)r->internal;
+    textbuffer_t*buf = (textbuffer_t*)r->internal;
     r->internal = 0;
-    while(i) {
-	textpage_t*next = i->next;
-	free(i->text);i->text = 0;
-	free(i);
-	i = next;
-    }
+    if(buf)
+	textbuffer_destroy(buf);
     free(r);
 }
 
+int text_stream_result_save(gfxresult_t*r, const char*filename)
+{
+    return 0; // the text was already written while rendering
+}
+void*text_stream_result_get(gfxresult_t*r, const char*name)
+{
+    return 0;
+}
+
+static gfxresult_t* text_stream_finish(struct _gfxdevice*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    if(i->buf->textpos) {
+	/* text drawn outside of startpage/endpage */
+	flushpage(dev);
+    }
+    textbuffer_destroy(i->buf);
+    if(i->writer == &i->fdwriter) {
+	i->fdwriter.finish(&i->fdwriter);
+    }
+
+    gfxresult_t* res = (gfxresult_t*)rfx_calloc(sizeof(gfxresult_t));
+    res->write = text_result_write;
+    res->save = text_stream_result_save;
+    res->get = text_stream_result_get;
+    res->destroy = text_result_destroy;
+
+    free(dev->internal); dev->internal = 0; i = 0;
+    return res;
+}
+
 gfxresult_t* text_finish(struct _gfxdevice*dev)
 {
     internal_t*i = (internal_t*)dev->internal;
+    if(i->writer) {
+	return text_stream_finish(dev);
+    }
     
     gfxresult_t* res = (gfxresult_t*)rfx_calloc(sizeof(gfxresult_t));
     
-    res->internal = i->first_page;i->first_page = 0;i->current_page=0;
+    res->internal = i->buf;i->buf = 0;
     res->write = text_result_write;
     res->save = text_result_save;
     res->get = text_result_get;
@@ -237,6 +305,7 @@ void gfxdevice_text_init(gfxdevice_t*dev, gfxdevice_t*out)
     dev->name = "text";
 
     dev->internal = i;
+    i->buf = textbuffer_new();
 
     dev->setparameter = text_setparameter;
     dev->startpage = text_startpage;
@@ -253,3 +322,17 @@ void gfxdevice_text_init(gfxdevice_t*dev, gfxdevice_t*out)
     dev->finish = text_finish;
 }
 
+void gfxdevice_text_init_stream(gfxdevice_t*dev, writer_t*w)
+{
+    gfxdevice_text_init(dev, 0);
+    internal_t*i = (internal_t*)dev->internal;
+    i->writer = w;
+}
+
+void gfxdevice_text_init_fd(gfxdevice_t*dev, int fd)
+{
+    gfxdevice_text_init(dev, 0);
+    internal_t*i = (internal_t*)dev->internal;
+    writer_init_filewriter(&i->fdwriter, fd);
+    i->writer = &i->fdwriter;
+}
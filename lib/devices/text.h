@@ -23,6 +23,7 @@
 #define __gfxdevice_text_h__
 
 #include "../gfxdevice.h"
+#include "../bitio.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +31,16 @@ extern "C" {
 
 void gfxdevice_text_init(gfxdevice_t*dev);
 
+/* Write the text of every page to w as soon as the page is finished,
+   instead of keeping the whole document in memory. Set the parameter
+   "formfeed" to separate pages with \f. The result of finish() holds no
+   text. The writer is not finished by the device. */
+void gfxdevice_text_init_stream(gfxdevice_t*dev, writer_t*w);
+
+/* Same as gfxdevice_text_init_stream, writing to a file descriptor (which
+   is not closed). */
+void gfxdevice_text_init_fd(gfxdevice_t*dev, int fd);
+
 #ifdef __cplusplus
 }
 #endif
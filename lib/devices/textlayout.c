@@ -0,0 +1,814 @@
+/* textlayout.c
+
+   Reconstructs words, lines and blocks from the characters of a page,
+   and writes them in reading order.
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "../types.h"
+#include "../mem.h"
+#include "../gfxdevice.h"
+#include "../gfxtools.h"
+#include "../utf8.h"
+#include "../bitio.h"
+#include "../kdtree.h"
+#include "textlayout.h"
+
+/* all distances are relative to the font size (ascent+descent) */
+#define MAX_BASELINE_SHIFT 0.3  // chars on one line
+#define MAX_CHAR_GAP 0.8        // larger horizontal gaps end a line
+#define MIN_WORD_GAP 0.1        // larger horizontal gaps start a new word
+#define DUPLICATE_DISTANCE 0.1  // same char drawn twice (fake bold)
+#define MAX_LINE_GAP 0.6        // vertical gap between lines of one block
+#define MAX_SIZE_RATIO 1.4      // font size change between lines of one block
+
+/* blocks are put into reading order by comparing all pairs of them,
+   which is cubic. Pages with more blocks are just sorted by position. */
+#define MAX_ORDERED_BLOCKS 200
+
+/* kdtree coordinates are integers */
+#define KD_SCALE 16.0
+
+typedef enum {FORMAT_TEXT, FORMAT_JSON, FORMAT_TSV} format_t;
+
+typedef struct _layoutchar {
+    int unicode;
+    double x,y; // origin, on the baseline
+    double x1,y1,x2,y2;
+    double size;
+    int prev,next; // neighbors on the same line, or -1
+    char duplicate;
+} layoutchar_t;
+
+typedef struct _layoutline {
+    int first;
+    double x1,y1,x2,y2;
+    double y; // baseline
+    double size;
+    int parent; // union-find, for grouping lines into blocks
+} layoutline_t;
+
+typedef struct _layoutblock {
+    int first; // index into line order
+    int num_lines;
+    double x1,y1,x2,y2;
+} layoutblock_t;
+
+typedef struct _layoutword {
+    int first, last;
+    double x1,y1,x2,y2;
+    double size;
+} layoutword_t;
+
+typedef struct _internal {
+    layoutchar_t*chars;
+    int num_chars;
+    int chars_size;
+
+    int pagenr;
+    int width, height;
+
+    format_t format;
+    char formfeed;
+    char header_written;
+    int pages_written;
+
+    writer_t*writer;
+    writer_t memwriter;
+    writer_t pagebuf; // output of the current page, passed to writer in one go
+} internal_t;
+
+typedef struct _textlayout_result {
+    char*data;
+    int length;
+} textlayout_result_t;
+
+static inline int32_t kd(double v)
+{
+    return (int32_t)floor(v*KD_SCALE);
+}
+
+static kdbbox_t kdbbox(double x1, double y1, double x2, double y2)
+{
+    kdbbox_t b;
+    b.xmin = kd(x1); b.ymin = kd(y1);
+    b.xmax = kd(x2); b.ymax = kd(y2);
+    if(b.xmax < b.xmin) b.xmax = b.xmin;
+    if(b.ymax < b.ymin) b.ymax = b.ymin;
+    return b;
+}
+
+static kdresult_list_t* find_in_box(kdboxtree_t*tree, double x1, double y1, double x2, double y2)
+{
+    kdbbox_t b = kdbbox(x1, y1, x2, y2);
+    return kdboxtree_find_in_box(tree, b.xmin, b.ymin, b.xmax, b.ymax);
+}
+
+static void kdresult_list_free(kdresult_list_t*l)
+{
+    while(l) {
+	kdresult_list_t*next = l->next;
+	free(l);
+	l = next;
+    }
+}
+
+static void writer_printf(writer_t*w, const char*format, ...)
+{
+    char buf[1024];
+    va_list arglist;
+    va_start(arglist, format);
+    vsnprintf(buf, sizeof(buf)-1, format, arglist);
+    va_end(arglist);
+    w->write(w, buf, strlen(buf));
+}
+
+static void writer_puts(writer_t*w, const char*s)
+{
+    w->write(w, (void*)s, strlen(s));
+}
+
+/* --------------------------- layout analysis ----------------------------- */
+
+/* connect every char with the closest char to its right on the same line */
+static void link_chars(internal_t*i)
+{
+    layoutchar_t*chars = i->chars;
+    kdboxentry_t*boxes = (kdboxentry_t*)rfx_calloc(sizeof(kdboxentry_t)*(i->num_chars+1));
+    int t;
+    for(t=0;t<i->num_chars;t++) {
+	layoutchar_t*c = &chars[t];
+	c->prev = c->next = -1;
+	c->duplicate = 0;
+	boxes[t].bbox = kdbbox(c->x1, c->y1, c->x2, c->y2);
+	boxes[t].data = c;
+    }
+    kdboxtree_t*tree = kdboxtree_new(boxes, i->num_chars);
+    free(boxes);
+
+    for(t=0;t<i->num_chars;t++) {
+	layoutchar_t*c = &chars[t];
+	if(c->duplicate)
+	    continue;
+	double d = DUPLICATE_DISTANCE*c->size;
+	kdresult_list_t*r = find_in_box(tree, c->x1, c->y1, c->x2, c->y2);
+	kdresult_list_t*l;
+	for(l=r;l;l=l->next) {
+	    layoutchar_t*c2 = (layoutchar_t*)l->data;
+	    if(c2 > c && c2->unicode == c->unicode &&
+	       fabs(c2->x - c->x) < d && fabs(c2->y - c->y) < d) {
+		c2->duplicate = 1;
+	    }
+	}
+	kdresult_list_free(r);
+    }
+
+    for(t=0;t<i->num_chars;t++) {
+	layoutchar_t*c = &chars[t];
+	if(c->duplicate)
+	    continue;
+	double maxgap = MAX_CHAR_GAP*c->size;
+	double ymid = (c->y1+c->y2)/2;
+	double h = (c->y2-c->y1)/8;
+	kdresult_list_t*r = find_in_box(tree, c->x, ymid-h, c->x2+maxgap, ymid+h);
+	kdresult_list_t*l;
+	layoutchar_t*best = 0;
+	for(l=r;l;l=l->next) {
+	    layoutchar_t*c2 = (layoutchar_t*)l->data;
+	    if(c2 == c || c2->duplicate || c2->x <= c->x)
+		continue;
+	    if(fabs(c2->y - c->y) > MAX_BASELINE_SHIFT*fmin(c->size, c2->size))
+		continue;
+	    if(c2->x1 - c->x2 > maxgap)
+		continue;
+	    if(!best || c2->x < best->x)
+		best = c2;
+	}
+	kdresult_list_free(r);
+
+	if(best) {
+	    /* if several chars have the same right neighbor, the
+	       closest one wins */
+	    if(best->prev >= 0 && chars[best->prev].x2 >= c->x2)
+		continue;
+	    if(best->prev >= 0)
+		chars[best->prev].next = -1;
+	    best->prev = t;
+	    c->next = best - chars;
+	}
+    }
+    kdboxtree_destroy(tree);
+}
+
+static layoutline_t* find_lines(internal_t*i, int*num_lines)
+{
+    layoutline_t*lines = (layoutline_t*)rfx_calloc(sizeof(layoutline_t)*(i->num_chars+1));
+    int num = 0;
+    int t;
+    for(t=0;t<i->num_chars;t++) {
+	layoutchar_t*c = &i->chars[t];
+	if(c->duplicate || c->prev >= 0)
+	    continue;
+	layoutline_t*line = &lines[num];
+	line->first = t;
+	line->parent = num;
+	line->x1 = c->x1; line->y1 = c->y1;
+	line->x2 = c->x2; line->y2 = c->y2;
+	line->y = c->y;
+	line->size = c->size;
+	while(c->next >= 0) {
+	    c = &i->chars[c->next];
+	    if(c->x1 < line->x1) line->x1 = c->x1;
+	    if(c->y1 < line->y1) line->y1 = c->y1;
+	    if(c->x2 > line->x2) line->x2 = c->x2;
+	    if(c->y2 > line->y2) line->y2 = c->y2;
+	    if(c->size > line->size) line->size = c->size;
+	}
+	num++;
+    }
+    *num_lines = num;
+    return lines;
+}
+
+static int line_root(layoutline_t*lines, int l)
+{
+    while(lines[l].parent != l) {
+	lines[l].parent = lines[lines[l].parent].parent;
+	l = lines[l].parent;
+    }
+    return l;
+}
+
+/* join every line with the closest line below it, if they look like
+   they belong to the same paragraph */
+static void group_lines(layoutline_t*lines, int num_lines)
+{
+    kdboxentry_t*boxes = (kdboxentry_t*)rfx_calloc(sizeof(kdboxentry_t)*(num_lines+1));
+    int t;
+    for(t=0;t<num_lines;t++) {
+	boxes[t].bbox = kdbbox(lines[t].x1, lines[t].y1, lines[t].x2, lines[t].y2);
+	boxes[t].data = &lines[t];
+    }
+    kdboxtree_t*tree = kdboxtree_new(boxes, num_lines);
+    free(boxes);
+    for(t=0;t<num_lines;t++) {
+	layoutline_t*l = &lines[t];
+	kdresult_list_t*r = find_in_box(tree, l->x1, l->y, l->x2, l->y2 + MAX_LINE_GAP*l->size);
+	kdresult_list_t*i;
+	layoutline_t*best = 0;
+	for(i=r;i;i=i->next) {
+	    layoutline_t*l2 = (layoutline_t*)i->data;
+	    if(l2 == l)
+		continue;
+	    double minsize = fmin(l->size, l2->size);
+	    double maxsize = fmax(l->size, l2->size);
+	    if(l2->y < l->y + minsize/2 || maxsize > minsize*MAX_SIZE_RATIO)
+		continue;
+	    if(l2->y1 - l->y2 > MAX_LINE_GAP*l->size)
+		continue;
+	    double overlap = fmin(l->x2, l2->x2) - fmax(l->x1, l2->x1);
+	    if(overlap < fmin(l->x2 - l->x1, l2->x2 - l2->x1)/2)
+		continue;
+	    if(!best || l2->y < best->y || (l2->y == best->y && l2->x1 < best->x1))
+		best = l2;
+	}
+	kdresult_list_free(r);
+	if(best) {
+	    int r1 = line_root(lines, t);
+	    int r2 = line_root(lines, best - lines);
+	    if(r1 != r2)
+		lines[r2].parent = r1;
+	}
+    }
+    kdboxtree_destroy(tree);
+}
+
+typedef struct _lineorder {
+    int block;
+    double y, x;
+    int line;
+} lineorder_t;
+
+static int compare_lineorder(const void*_a, const void*_b)
+{
+    const lineorder_t*a = (const lineorder_t*)_a;
+    const lineorder_t*b = (const lineorder_t*)_b;
+    if(a->block != b->block)
+	return a->block - b->block;
+    if(a->y != b->y)
+	return a->y < b->y ? -1 : 1;
+    if(a->x != b->x)
+	return a->x < b->x ? -1 : 1;
+    return 0;
+}
+
+static layoutblock_t* find_blocks(layoutline_t*lines, int num_lines, lineorder_t*order, int*num_blocks)
+{
+    int t;
+    for(t=0;t<num_lines;t++) {
+	order[t].block = line_root(lines, t);
+	order[t].y = lines[t].y;
+	order[t].x = lines[t].x1;
+	order[t].line = t;
+    }
+    qsort(order, num_lines, sizeof(lineorder_t), compare_lineorder);
+
+    layoutblock_t*blocks = (layoutblock_t*)rfx_calloc(sizeof(layoutblock_t)*(num_lines+1));
+    int num = 0;
+    for(t=0;t<num_lines;t++) {
+	layoutline_t*l = &lines[order[t].line];
+	if(!t || order[t].block != order[t-1].block) {
+	    layoutblock_t*b = &blocks[num++];
+	    b->first = t;
+	    b->x1 = l->x1; b->y1 = l->y1;
+	    b->x2 = l->x2; b->y2 = l->y2;
+	} else {
+	    layoutblock_t*b = &blocks[num-1];
+	    if(l->x1 < b->x1) b->x1 = l->x1;
+	    if(l->y1 < b->y1) b->y1 = l->y1;
+	    if(l->x2 > b->x2) b->x2 = l->x2;
+	    if(l->y2 > b->y2) b->y2 = l->y2;
+	}
+	blocks[num-1].num_lines++;
+    }
+    *num_blocks = num;
+    return blocks;
+}
+
+static layoutblock_t*sort_blocks;
+static int compare_blockpos(const void*_a, const void*_b)
+{
+    layoutblock_t*a = &sort_blocks[*(const int*)_a];
+    layoutblock_t*b = &sort_blocks[*(const int*)_b];
+    if(a->y1 != b->y1)
+	return a->y1 < b->y1 ? -1 : 1;
+    if(a->x1 != b->x1)
+	return a->x1 < b->x1 ? -1 : 1;
+    return 0;
+}
+
+static inline char x_overlap(layoutblock_t*a, layoutblock_t*b)
+{
+    return a->x1 < b->x2 && b->x1 < a->x2;
+}
+
+/* Reading order, following Breuel, "High Performance Document Layout
+   Analysis": a block comes before another block if they overlap
+   horizontally and it is above it, or if it is to the left of it and
+   there's no third block between the two which overlaps both.
+   Blocks which are below the whole column of the other block (footers,
+   page numbers) are exempt from the second rule. */
+static void order_blocks(layoutblock_t*blocks, int num, int*order)
+{
+    int t,s,u;
+    for(t=0;t<num;t++)
+	order[t] = t;
+    if(num <= 1)
+	return;
+    if(num > MAX_ORDERED_BLOCKS) {
+	sort_blocks = blocks;
+	qsort(order, num, sizeof(int), compare_blockpos);
+	sort_blocks = 0;
+	return;
+    }
+
+    char*before = (char*)rfx_calloc(num*num);
+    int*preds = (int*)rfx_calloc(sizeof(int)*num);
+    double*column_bottom = (double*)rfx_calloc(sizeof(double)*num);
+    for(t=0;t<num;t++) {
+	column_bottom[t] = blocks[t].y2;
+	for(s=0;s<num;s++) {
+	    if(x_overlap(&blocks[t], &blocks[s]) && blocks[s].y2 > column_bottom[t])
+		column_bottom[t] = blocks[s].y2;
+	}
+    }
+    for(t=0;t<num;t++) {
+	layoutblock_t*a = &blocks[t];
+	double ya = (a->y1+a->y2)/2;
+	for(s=0;s<num;s++) {
+	    if(s == t)
+		continue;
+	    layoutblock_t*b = &blocks[s];
+	    double yb = (b->y1+b->y2)/2;
+	    char is_before = 0;
+	    if(x_overlap(a,b)) {
+		is_before = ya < yb;
+	    } else if(a->x2 <= b->x1 && a->y1 < column_bottom[s]) {
+		is_before = 1;
+		double ymin = fmin(ya,yb), ymax = fmax(ya,yb);
+		for(u=0;u<num;u++) {
+		    layoutblock_t*c = &blocks[u];
+		    double yc = (c->y1+c->y2)/2;
+		    if(u != t && u != s && yc > ymin && yc < ymax &&
+		       x_overlap(a,c) && x_overlap(b,c)) {
+			is_before = 0;
+			break;
+		    }
+		}
+	    }
+	    if(is_before) {
+		before[t*num+s] = 1;
+		preds[s]++;
+	    }
+	}
+    }
+
+    /* topological sort. Of all blocks which are ready, take the topmost one.
+       If there's a cycle, take the topmost remaining block. */
+    char*done = (char*)rfx_calloc(num);
+    for(t=0;t<num;t++) {
+	int best = -1;
+	char best_ready = 0;
+	for(s=0;s<num;s++) {
+	    if(done[s])
+		continue;
+	    char ready = !preds[s];
+	    if(best < 0 || (ready && !best_ready) ||
+	       (ready == best_ready && blocks[s].y1 < blocks[best].y1)) {
+		best = s;
+		best_ready = ready;
+	    }
+	}
+	done[best] = 1;
+	order[t] = best;
+	for(s=0;s<num;s++) {
+	    if(before[best*num+s])
+		preds[s]--;
+	}
+    }
+    free(done);
+    free(column_bottom);
+    free(preds);
+    free(before);
+}
+
+static int find_words(internal_t*i, layoutline_t*line, layoutword_t*words)
+{
+    int num = 0;
+    int c = line->first;
+    layoutchar_t*last = 0;
+    while(c >= 0) {
+	layoutchar_t*ch = &i->chars[c];
+	if(!last || ch->x1 - last->x2 > MIN_WORD_GAP*fmax(ch->size, last->size)) {
+	    layoutword_t*w = &words[num++];
+	    w->first = w->last = c;
+	    w->x1 = ch->x1; w->y1 = ch->y1;
+	    w->x2 = ch->x2; w->y2 = ch->y2;
+	    w->size = ch->size;
+	} else {
+	    layoutword_t*w = &words[num-1];
+	    w->last = c;
+	    if(ch->x1 < w->x1) w->x1 = ch->x1;
+	    if(ch->y1 < w->y1) w->y1 = ch->y1;
+	    if(ch->x2 > w->x2) w->x2 = ch->x2;
+	    if(ch->y2 > w->y2) w->y2 = ch->y2;
+	    if(ch->size > w->size) w->size = ch->size;
+	}
+	last = ch;
+	c = ch->next;
+    }
+    return num;
+}
+
+/* ------------------------------- output ---------------------------------- */
+
+static void write_word(internal_t*i, layoutword_t*w, char json)
+{
+    char buf[16];
+    int c = w->first;
+    while(1) {
+	layoutchar_t*ch = &i->chars[c];
+	if(json && (ch->unicode == '"' || ch->unicode == '\\')) {
+	    buf[0] = '\\';
+	    buf[1] = ch->unicode;
+	    buf[2] = 0;
+	} else {
+	    writeUTF8(ch->unicode, buf);
+	}
+	writer_puts(&i->pagebuf, buf);
+	if(c == w->last)
+	    break;
+	c = ch->next;
+    }
+}
+
+static void write_bbox(internal_t*i, double x1, double y1, double x2, double y2)
+{
+    writer_printf(&i->pagebuf, "\"bbox\":[%.2f,%.2f,%.2f,%.2f]", x1, y1, x2, y2);
+}
+
+static void write_page(internal_t*i)
+{
+    int t,s,u;
+    link_chars(i);
+
+    int num_lines = 0;
+    layoutline_t*lines = find_lines(i, &num_lines);
+    group_lines(lines, num_lines);
+    lineorder_t*lineorder = (lineorder_t*)rfx_calloc(sizeof(lineorder_t)*(num_lines+1));
+    int num_blocks = 0;
+    layoutblock_t*blocks = find_blocks(lines, num_lines, lineorder, &num_blocks);
+    int*order = (int*)rfx_calloc(sizeof(int)*(num_blocks+1));
+    order_blocks(blocks, num_blocks, order);
+    layoutword_t*words = (layoutword_t*)rfx_calloc(sizeof(layoutword_t)*(i->num_chars+1));
+
+    writer_t*w = &i->pagebuf;
+    writer_growmemwrite_reset(w);
+    if(i->format == FORMAT_TEXT) {
+	if(i->formfeed && i->pages_written)
+	    writer_writeU8(w, 12);
+    } else if(i->format == FORMAT_JSON) {
+	writer_printf(w, "{\"page\":%d,\"width\":%d,\"height\":%d,\"blocks\":[", i->pagenr, i->width, i->height);
+    } else if(i->format == FORMAT_TSV && !i->header_written) {
+	writer_puts(w, "page\tblock\tline\tword\tx1\ty1\tx2\ty2\tsize\ttext\n");
+	i->header_written = 1;
+    }
+
+    for(t=0;t<num_blocks;t++) {
+	layoutblock_t*b = &blocks[order[t]];
+	if(i->format == FORMAT_TEXT && t) {
+	    writer_writeU8(w, '\n');
+	} else if(i->format == FORMAT_JSON) {
+	    writer_puts(w, t?",{":"{");
+	    write_bbox(i, b->x1, b->y1, b->x2, b->y2);
+	    writer_puts(w, ",\"lines\":[");
+	}
+	for(s=0;s<b->num_lines;s++) {
+	    layoutline_t*l = &lines[lineorder[b->first+s].line];
+	    int num_words = find_words(i, l, words);
+	    if(i->format == FORMAT_JSON) {
+		writer_puts(w, s?",{":"{");
+		write_bbox(i, l->x1, l->y1, l->x2, l->y2);
+		writer_puts(w, ",\"words\":[");
+	    }
+	    for(u=0;u<num_words;u++) {
+		layoutword_t*word = &words[u];
+		if(i->format == FORMAT_TEXT) {
+		    if(u)
+			writer_writeU8(w, ' ');
+		    write_word(i, word, 0);
+		} else if(i->format == FORMAT_JSON) {
+		    writer_puts(w, u?",{\"text\":\"":"{\"text\":\"");
+		    write_word(i, word, 1);
+		    writer_puts(w, "\",");
+		    write_bbox(i, word->x1, word->y1, word->x2, word->y2);
+		    writer_printf(w, ",\"size\":%.2f}", word->size);
+		} else if(i->format == FORMAT_TSV) {
+		    writer_printf(w, "%d\t%d\t%d\t%d\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\t",
+			    i->pagenr, t+1, s+1, u+1,
+			    word->x1, word->y1, word->x2, word->y2, word->size);
+		    write_word(i, word, 0);
+		    writer_writeU8(w, '\n');
+		}
+	    }
+	    if(i->format == FORMAT_TEXT) {
+		writer_writeU8(w, '\n');
+	    } else if(i->format == FORMAT_JSON) {
+		writer_puts(w, "]}");
+	    }
+	}
+	if(i->format == FORMAT_JSON) {
+	    writer_puts(w, "]}");
+	}
+    }
+    if(i->format == FORMAT_JSON) {
+	writer_puts(w, "]}\n");
+    }
+    int len = 0;
+    void*data = writer_growmemwrite_memptr(w, &len);
+    i->writer->write(i->writer, data, len);
+    i->pages_written++;
+
+    free(words);
+    free(order);
+    free(blocks);
+    free(lineorder);
+    free(lines);
+    i->num_chars = 0;
+}
+
+/* --------------------------- device operations --------------------------- */
+
+static int textlayout_setparameter(gfxdevice_t*dev, const char*key, const char*value)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    if(!strcmp(key, "format")) {
+	if(!strcmp(value, "text") || !strcmp(value, "txt")) {
+	    i->format = FORMAT_TEXT;
+	} else if(!strcmp(value, "json")) {
+	    i->format = FORMAT_JSON;
+	} else if(!strcmp(value, "tsv")) {
+	    i->format = FORMAT_TSV;
+	} else {
+	    return 0;
+	}
+	return 1;
+    } else if(!strcmp(key, "formfeed")) {
+	i->formfeed = atoi(value);
+	return 1;
+    }
+    return 0;
+}
+
+static void textlayout_startpage(gfxdevice_t*dev, int width, int height)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    if(i->num_chars) {
+	/* chars drawn outside of startpage/endpage */
+	write_page(i);
+    }
+    i->pagenr++;
+    i->width = width;
+    i->height = height;
+}
+
+static void textlayout_startclip(gfxdevice_t*dev, gfxline_t*line) {}
+static void textlayout_endclip(gfxdevice_t*dev) {}
+static void textlayout_stroke(gfxdevice_t*dev, gfxline_t*line, gfxcoord_t width, gfxcolor_t*color, gfx_capType cap_style, gfx_joinType joint_style, gfxcoord_t miterLimit) {}
+static void textlayout_fill(gfxdevice_t*dev, gfxline_t*line, gfxcolor_t*color) {}
+static void textlayout_fillbitmap(gfxdevice_t*dev, gfxline_t*line, gfximage_t*img, gfxmatrix_t*matrix, gfxcxform_t*cxform) {}
+static void textlayout_fillgradient(gfxdevice_t*dev, gfxline_t*line, gfxgradient_t*gradient, gfxgradienttype_t type, gfxmatrix_t*matrix) {}
+static void textlayout_addfont(gfxdevice_t*dev, gfxfont_t*font) {}
+static void textlayout_drawlink(gfxdevice_t*dev, gfxline_t*line, const char*action, const char*text) {}
+
+static void textlayout_drawchar(gfxdevice_t*dev, gfxfont_t*font, int glyphnr, gfxcolor_t*color, gfxmatrix_t*matrix)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    if(!font || glyphnr < 0 || glyphnr >= font->num_glyphs)
+	return;
+    gfxglyph_t*glyph = &font->glyphs[glyphnr];
+    int u = glyph->unicode;
+    if(u <= 32 || u == 0xa0) {
+	/* spaces are not stored, words are separated by the gaps between them */
+	return;
+    }
+
+    double ascent = font->ascent;
+    double descent = font->descent;
+    if(ascent + descent <= 0) {
+	gfxbbox_t b = gfxline_getbbox(glyph->line);
+	ascent = -b.ymin;
+	descent = b.ymax;
+	if(ascent + descent <= 0) {
+	    ascent = glyph->advance;
+	    descent = 0;
+	}
+    }
+    double size = (ascent+descent)*sqrt(matrix->m10*matrix->m10 + matrix->m11*matrix->m11);
+    if(size <= 0)
+	return;
+
+    if(i->num_chars == i->chars_size) {
+	i->chars_size = i->chars_size ? i->chars_size*2 : 1024;
+	i->chars = (layoutchar_t*)rfx_realloc(i->chars, sizeof(layoutchar_t)*i->chars_size);
+    }
+    layoutchar_t*c = &i->chars[i->num_chars++];
+    c->unicode = u;
+    c->x = matrix->tx;
+    c->y = matrix->ty;
+    c->size = size;
+
+    /* transform the glyph's box (advance x ascent+descent) */
+    double px[4] = {0, glyph->advance, 0, glyph->advance};
+    double py[4] = {-ascent, -ascent, descent, descent};
+    int t;
+    for(t=0;t<4;t++) {
+	double x = px[t]*matrix->m00 + py[t]*matrix->m10 + matrix->tx;
+	double y = px[t]*matrix->m01 + py[t]*matrix->m11 + matrix->ty;
+	if(!t || x < c->x1) c->x1 = x;
+	if(!t || y < c->y1) c->y1 = y;
+	if(!t || x > c->x2) c->x2 = x;
+	if(!t || y > c->y2) c->y2 = y;
+    }
+}
+
+static void textlayout_endpage(gfxdevice_t*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    write_page(i);
+}
+
+static int textlayout_result_save(gfxresult_t*r, const char*filename)
+{
+    textlayout_result_t*res = (textlayout_result_t*)r->internal;
+    if(!res->data)
+	return 0;
+    FILE*fi = fopen(filename, "wb");
+    if(!fi)
+	return 0;
+    fwrite(res->data, res->length, 1, fi);
+    fclose(fi);
+    return 1;
+}
+
+static void* textlayout_result_get(gfxresult_t*r, const char*name)
+{
+    textlayout_result_t*res = (textlayout_result_t*)r->internal;
+    if(!strcmp(name,"text") && res->data) {
+	char*text = (char*)malloc(res->length+1);
+	memcpy(text, res->data, res->length);
+	text[res->length] = 0;
+	return text;
+    }
+    return 0;
+}
+
+static void textlayout_result_write(gfxresult_t*r, int filedesc)
+{
+    textlayout_result_t*res = (textlayout_result_t*)r->internal;
+    if(res->data)
+	write(filedesc, res->data, res->length);
+}
+
+static void textlayout_result_destroy(gfxresult_t*r)
+{
+    textlayout_result_t*res = (textlayout_result_t*)r->internal;
+    if(res->data)
+	free(res->data);
+    free(res);
+    free(r);
+}
+
+static gfxresult_t* textlayout_finish(gfxdevice_t*dev)
+{
+    internal_t*i = (internal_t*)dev->internal;
+    if(i->num_chars)
+	write_page(i);
+
+    textlayout_result_t*res = (textlayout_result_t*)rfx_calloc(sizeof(textlayout_result_t));
+    if(i->writer == &i->memwriter) {
+	res->length = i->memwriter.pos;
+	res->data = (char*)writer_growmemwrite_getmem(&i->memwriter);
+	i->memwriter.finish(&i->memwriter);
+    }
+
+    gfxresult_t*r = (gfxresult_t*)rfx_calloc(sizeof(gfxresult_t));
+    r->internal = res;
+    r->write = textlayout_result_write;
+    r->save = textlayout_result_save;
+    r->get = textlayout_result_get;
+    r->destroy = textlayout_result_destroy;
+
+    if(i->chars)
+	free(i->chars);
+    i->pagebuf.finish(&i->pagebuf);
+    free(dev->internal); dev->internal = 0; i = 0;
+    return r;
+}
+
+void gfxdevice_textlayout_init_stream(gfxdevice_t*dev, writer_t*w)
+{
+    internal_t*i = (internal_t*)rfx_calloc(sizeof(internal_t));
+    memset(dev, 0, sizeof(gfxdevice_t));
+
+    dev->name = "textlayout";
+
+    dev->internal = i;
+
+    if(w) {
+	i->writer = w;
+    } else {
+	writer_init_growingmemwriter(&i->memwriter, 65536);
+	i->writer = &i->memwriter;
+    }
+    writer_init_growingmemwriter(&i->pagebuf, 65536);
+
+    dev->setparameter = textlayout_setparameter;
+    dev->startpage = textlayout_startpage;
+    dev->startclip = textlayout_startclip;
+    dev->endclip = textlayout_endclip;
+    dev->stroke = textlayout_stroke;
+    dev->fill = textlayout_fill;
+    dev->fillbitmap = textlayout_fillbitmap;
+    dev->fillgradient = textlayout_fillgradient;
+    dev->addfont = textlayout_addfont;
+    dev->drawchar = textlayout_drawchar;
+    dev->drawlink = textlayout_drawlink;
+    dev->endpage = textlayout_endpage;
+    dev->finish = textlayout_finish;
+}
+
+void gfxdevice_textlayout_init(gfxdevice_t*dev)
+{
+    gfxdevice_textlayout_init_stream(dev, 0);
+}
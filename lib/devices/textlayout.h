@@ -0,0 +1,50 @@
+/* textlayout.h
+   Header file for textlayout.c
+
+   Part of the swftools package.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __gfxdevice_textlayout_h__
+#define __gfxdevice_textlayout_h__
+
+#include "../gfxdevice.h"
+#include "../bitio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A text device which groups the characters of every page into words,
+   lines and blocks, and writes them in reading order.
+
+   Parameters:
+     format=text   plain text, blocks separated by empty lines (default)
+     format=json   one JSON object per page, with bounding boxes and
+                   font sizes of blocks, lines and words
+     format=tsv    one row per word: page, block, line, word, bbox, size, text
+     formfeed=1    separate pages with \f (text format)
+*/
+void gfxdevice_textlayout_init(gfxdevice_t*dev);
+
+/* Same, but write each page to w as soon as it is finished. The result
+   of finish() holds no text. The writer is not finished by the device. */
+void gfxdevice_textlayout_init_stream(gfxdevice_t*dev, writer_t*w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__gfxdevice_textlayout_h__
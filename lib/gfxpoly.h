@@ -49,11 +49,20 @@ gfxpoly_t* gfxpoly_from_stroke(gfxline_t*line, gfxcoord_t width, gfx_capType cap
 /* operators */
 gfxpoly_t* gfxpoly_intersect(gfxpoly_t*p1, gfxpoly_t*p2);
 gfxpoly_t* gfxpoly_union(gfxpoly_t*p1, gfxpoly_t*p2);
+/* like gfxpoly_union, for num_polys>=1 polygons, in a single sweep */
+gfxpoly_t* gfxpoly_union_many(gfxpoly_t**polys, int num_polys);
 
 /* area functions */
 double gfxpoly_area(gfxpoly_t*p);
 double gfxpoly_intersection_area(gfxpoly_t*p1, gfxpoly_t*p2);
 
+/* bounding box functions. gfxpoly_getbbox() returns all zeros for an empty polygon,
+   gfxpoly_intersect_rectangles() requires gfxpoly_is_rectangle() to be true for both
+   polygons */
+gfxbbox_t gfxpoly_getbbox(gfxpoly_t*poly);
+char gfxpoly_is_rectangle(gfxpoly_t*poly);
+gfxpoly_t* gfxpoly_intersect_rectangles(gfxpoly_t*r1, gfxpoly_t*r2);
+
 /* conversion functions */
 gfxpoly_t* gfxpoly_createbox(double x1, double y1,double x2, double y2, double gridsize);
 gfxline_t* gfxline_from_gfxpoly(gfxpoly_t*poly);
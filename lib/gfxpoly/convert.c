@@ -548,3 +548,121 @@ gfxpoly_t* gfxpoly_createbox(double x1, double y1,double x2, double y2, double g
     return poly;
 }
 
+static char getbox(gfxpoly_t*poly, point_t*min, point_t*max)
+{
+    gfxpolystroke_t*stroke = poly->strokes;
+    if(!stroke)
+	return 0;
+    *min = *max = stroke->points[0];
+    for(;stroke;stroke=stroke->next) {
+	int t;
+	for(t=0;t<stroke->num_points;t++) {
+	    point_t p = stroke->points[t];
+	    if(p.x < min->x) min->x = p.x;
+	    if(p.y < min->y) min->y = p.y;
+	    if(p.x > max->x) max->x = p.x;
+	    if(p.y > max->y) max->y = p.y;
+	}
+    }
+    return 1;
+}
+
+gfxbbox_t gfxpoly_getbbox(gfxpoly_t*poly)
+{
+    gfxbbox_t b = {0,0,0,0};
+    point_t min,max;
+    if(getbox(poly, &min, &max)) {
+	b.xmin = min.x * poly->gridsize;
+	b.ymin = min.y * poly->gridsize;
+	b.xmax = max.x * poly->gridsize;
+	b.ymax = max.y * poly->gridsize;
+    }
+    return b;
+}
+
+typedef struct _span {
+    int32_t y1,y2;
+} span_t;
+
+static int compare_span(const void*_s1, const void*_s2)
+{
+    span_t*s1 = (span_t*)_s1;
+    span_t*s2 = (span_t*)_s2;
+    return s1->y1 < s2->y1 ? -1 : (s1->y1 > s2->y1);
+}
+
+/* check that the spans cover [y1,y2] exactly once */
+static char covers_once(span_t*spans, int num, int32_t y1, int32_t y2)
+{
+    qsort(spans, num, sizeof(span_t), compare_span);
+    int t;
+    for(t=0;t<num;t++) {
+	if(spans[t].y1 != y1)
+	    return 0;
+	y1 = spans[t].y2;
+    }
+    return y1 == y2;
+}
+
+#define MAX_RECTANGLE_SPANS 16
+
+char gfxpoly_is_rectangle(gfxpoly_t*poly)
+{
+    point_t min,max;
+    if(!getbox(poly, &min, &max) || min.x == max.x || min.y == max.y)
+	return 0;
+
+    /* every edge has to be on the border of the bounding box, and the
+       left and right border have to be covered exactly once- then, under
+       the even/odd rule, the polygon is the whole box */
+    span_t left[MAX_RECTANGLE_SPANS], right[MAX_RECTANGLE_SPANS];
+    int num_left = 0, num_right = 0;
+    gfxpolystroke_t*stroke;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+	int t;
+	for(t=0;t<stroke->num_points-1;t++) {
+	    point_t a = stroke->points[t];
+	    point_t b = stroke->points[t+1];
+	    if(a.y == b.y) {
+		if(a.y != min.y && a.y != max.y)
+		    return 0;
+	    } else if(a.x == b.x && a.x == min.x && num_left < MAX_RECTANGLE_SPANS) {
+		left[num_left].y1 = a.y;
+		left[num_left++].y2 = b.y;
+	    } else if(a.x == b.x && a.x == max.x && num_right < MAX_RECTANGLE_SPANS) {
+		right[num_right].y1 = a.y;
+		right[num_right++].y2 = b.y;
+	    } else {
+		return 0;
+	    }
+	}
+    }
+    return covers_once(left, num_left, min.y, max.y) &&
+	   covers_once(right, num_right, min.y, max.y);
+}
+
+gfxpoly_t* gfxpoly_intersect_rectangles(gfxpoly_t*r1, gfxpoly_t*r2)
+{
+    assert(r1->gridsize == r2->gridsize);
+    polywriter_t writer;
+    gfxpolywriter_init(&writer);
+    writer.setgridsize(&writer, r1->gridsize);
+
+    point_t min1,max1,min2,max2;
+    if(getbox(r1, &min1, &max1) && getbox(r2, &min2, &max2)) {
+	int32_t x1 = min1.x > min2.x ? min1.x : min2.x;
+	int32_t y1 = min1.y > min2.y ? min1.y : min2.y;
+	int32_t x2 = max1.x < max2.x ? max1.x : max2.x;
+	int32_t y2 = max1.y < max2.y ? max1.y : max2.y;
+	if(x1 < x2 && y1 < y2) {
+	    /* same outline as gfxpoly_from_fill() would create */
+	    writer.moveto(&writer, x1, y1);
+	    writer.lineto(&writer, x2, y1);
+	    writer.lineto(&writer, x2, y2);
+	    writer.lineto(&writer, x1, y2);
+	    writer.lineto(&writer, x1, y1);
+	}
+    }
+    return (gfxpoly_t*)writer.finish(&writer);
+}
+
@@ -27,4 +27,8 @@ gfxline_t*gfxline_from_gfxpoly_with_direction(gfxpoly_t*poly); // preserves up/d
 gfxline_t* gfxpoly_circular_to_evenodd(gfxline_t*line, double gridsize);
 gfxpoly_t* gfxpoly_createbox(double x1, double y1,double x2, double y2, double gridsize);
 
+gfxbbox_t gfxpoly_getbbox(gfxpoly_t*poly);
+char gfxpoly_is_rectangle(gfxpoly_t*poly);
+gfxpoly_t* gfxpoly_intersect_rectangles(gfxpoly_t*r1, gfxpoly_t*r2);
+
 #endif //__poly_convert_h__
@@ -18,6 +18,8 @@
 #endif
 
 static gfxpoly_t*current_polygon = 0;
+gfxpoly_stats_t gfxpoly_stats;
+
 void gfxpoly_fail(char*expr, char*file, int line, const char*function)
 {
     if(!current_polygon) {
@@ -153,6 +155,71 @@ typedef struct _horizdata {
     int size;
 } horizdata_t;
 
+/* Events and segments only live for the duration of one sweep, and there are
+   a lot of them (at least one event and one segment per input edge). Instead of
+   going through malloc() for every single one of them, carve them out of
+   larger blocks, recycle freed items through a free list, and release
+   everything at once when the sweep is done. */
+#define ARENA_BLOCK_ITEMS 256
+
+typedef struct _arenablock {
+    struct _arenablock*next;
+} arenablock_t;
+
+typedef struct _arena {
+    int item_size;
+    void*free_items;
+    char*pos;
+    int left;
+    arenablock_t*blocks;
+    int num_blocks;
+} arena_t;
+
+static void arena_init(arena_t*a, int item_size)
+{
+    memset(a, 0, sizeof(arena_t));
+    /* freed items are chained through their first pointer-sized bytes */
+    a->item_size = item_size < sizeof(void*) ? sizeof(void*) : item_size;
+}
+static void* arena_alloc(arena_t*a)
+{
+    void*item;
+    if(a->free_items) {
+	item = a->free_items;
+	a->free_items = *(void**)item;
+    } else {
+	if(!a->left) {
+	    /* the block header is padded to 16 bytes to keep items aligned */
+	    arenablock_t*b = (arenablock_t*)malloc(16 + a->item_size*ARENA_BLOCK_ITEMS);
+	    b->next = a->blocks;
+	    a->blocks = b;
+	    a->num_blocks++;
+	    a->pos = (char*)b + 16;
+	    a->left = ARENA_BLOCK_ITEMS;
+	}
+	item = a->pos;
+	a->pos += a->item_size;
+	a->left--;
+    }
+    memset(item, 0, a->item_size);
+    return item;
+}
+static void arena_free(arena_t*a, void*item)
+{
+    *(void**)item = a->free_items;
+    a->free_items = item;
+}
+static void arena_destroy(arena_t*a)
+{
+    arenablock_t*b = a->blocks;
+    while(b) {
+	arenablock_t*next = b->next;
+	free(b);
+	b = next;
+    }
+    memset(a, 0, sizeof(arena_t));
+}
+
 typedef struct _status {
     int32_t y;
     double gridsize;
@@ -166,6 +233,11 @@ typedef struct _status {
     horizdata_t horiz;
 
     gfxpolystroke_t*strokes;
+
+    arena_t events;
+    arena_t segments;
+    int num_events;
+    int num_segments;
 #ifdef CHECKS
     dict_t*seen_crossings; //list of crossing we saw so far
     dict_t*intersecting_segs; //list of segments intersecting in this scanline
@@ -369,14 +441,13 @@ void gfxpoly_save_arrows(gfxpoly_t*poly, const char*filename)
     fclose(fi);
 }
 
-inline static event_t* event_new()
+inline static event_t* event_new(status_t*status)
 {
-    event_t*e = rfx_calloc(sizeof(event_t));
-    return e;
+    return (event_t*)arena_alloc(&status->events);
 }
-inline static void event_free(event_t*e)
+inline static void event_free(status_t*status, event_t*e)
 {
-    free(e);
+    arena_free(&status->events, e);
 }
 
 static void event_dump(status_t*status, event_t*e)
@@ -475,10 +546,11 @@ static void segment_init(segment_t*s, int32_t x1, int32_t y1, int32_t x2, int32_
 #endif
 }
 
-static segment_t* segment_new(point_t a, point_t b, int polygon_nr, segment_dir_t dir)
+static segment_t* segment_new(status_t*status, point_t a, point_t b, int polygon_nr, segment_dir_t dir)
 {
-    segment_t*s = (segment_t*)rfx_calloc(sizeof(segment_t));
+    segment_t*s = (segment_t*)arena_alloc(&status->segments);
     segment_init(s, a.x, a.y, b.x, b.y, polygon_nr, dir);
+    status->num_segments++;
     return s;
 }
 
@@ -488,13 +560,13 @@ static void segment_clear(segment_t*s)
     dict_clear(&s->scheduled_crossings);
 #endif
 }
-static void segment_destroy(segment_t*s)
+static void segment_destroy(status_t*status, segment_t*s)
 {
     segment_clear(s);
-    free(s);
+    arena_free(&status->segments, s);
 }
 
-static void advance_stroke(queue_t*queue, hqueue_t*hqueue, gfxpolystroke_t*stroke, int polygon_nr, int pos, double gridsize)
+static void advance_stroke(status_t*status, queue_t*queue, hqueue_t*hqueue, gfxpolystroke_t*stroke, int polygon_nr, int pos)
 {
     if(!stroke) 
 	return;
@@ -503,7 +575,7 @@ static void advance_stroke(queue_t*queue, hqueue_t*hqueue, gfxpolystroke_t*strok
        before horizontal events */
     while(pos < stroke->num_points-1) {
 	assert(stroke->points[pos].y <= stroke->points[pos+1].y);
-	s = segment_new(stroke->points[pos], stroke->points[pos+1], polygon_nr, stroke->dir);
+	s = segment_new(status, stroke->points[pos], stroke->points[pos+1], polygon_nr, stroke->dir);
 	s->fs = stroke->fs;
 	pos++;
 	s->stroke = 0;
@@ -512,11 +584,11 @@ static void advance_stroke(queue_t*queue, hqueue_t*hqueue, gfxpolystroke_t*strok
 	/*if(l->tmp)
 	    s->nr = l->tmp;*/
 	fprintf(stderr, "[%d] (%.2f,%.2f) -> (%.2f,%.2f) %s (stroke %p, %d more to come)\n",
-		s->nr, s->a.x * gridsize, s->a.y * gridsize, 
-		s->b.x * gridsize, s->b.y * gridsize,
+		s->nr, s->a.x * status->gridsize, s->a.y * status->gridsize, 
+		s->b.x * status->gridsize, s->b.y * status->gridsize,
 		s->dir==DIR_UP?"up":"down", stroke, stroke->num_points - 1 - pos);
 #endif
-	event_t* e = event_new();
+	event_t* e = event_new(status);
 	e->type = s->delta.y ? EVENT_START : EVENT_HORIZONTAL;
 	e->p = s->a;
 	e->s1 = s;
@@ -535,7 +607,7 @@ static void advance_stroke(queue_t*queue, hqueue_t*hqueue, gfxpolystroke_t*strok
     }
 }
 
-static void gfxpoly_enqueue(gfxpoly_t*p, queue_t*queue, hqueue_t*hqueue, int polygon_nr)
+static void gfxpoly_enqueue(status_t*status, gfxpoly_t*p, queue_t*queue, hqueue_t*hqueue, int polygon_nr)
 {
     int t;
     gfxpolystroke_t*stroke = p->strokes;
@@ -548,7 +620,7 @@ static void gfxpoly_enqueue(gfxpoly_t*p, queue_t*queue, hqueue_t*hqueue, int pol
 	    assert(stroke->points[s].y <= stroke->points[s+1].y);
 	}
 #endif
-	advance_stroke(queue, hqueue, stroke, polygon_nr, 0, p->gridsize);
+	advance_stroke(status, queue, hqueue, stroke, polygon_nr, 0);
     }
 }
 
@@ -556,7 +628,7 @@ static void schedule_endpoint(status_t*status, segment_t*s)
 {
     // schedule end point of segment
     assert(s->b.y > status->y);
-    event_t*e = event_new();
+    event_t*e = event_new(status);
     e->type = EVENT_END;
     e->p = s->b;
     e->s1 = s;
@@ -742,7 +814,7 @@ static void schedule_crossing(status_t*status, segment_t*s1, segment_t*s2)
     dict_put(&s2->scheduled_crossings, (void*)(ptroff_t)(s1->nr), 0);
 #endif
 
-    event_t* e = event_new();
+    event_t* e = event_new(status);
     e->type = EVENT_CROSS;
     e->p = p;
     e->s1 = s1;
@@ -1049,7 +1121,7 @@ static void add_points_to_ending_segments(status_t*status, int32_t y)
 #endif
         }
         // now that this is done, too, we can also finally free this segment
-        segment_destroy(seg);
+        segment_destroy(status, seg);
         seg = next;
     }
     status->ending_segments = 0;
@@ -1414,8 +1486,8 @@ static void event_apply(status_t*status, event_t*e)
             segment_t*s = e->s1;
             intersect_with_horizontal(status, s);
 	    store_horizontal(status, s->a, s->b, s->fs, s->dir, s->polygon_nr);
-	    advance_stroke(&status->queue, 0, s->stroke, s->polygon_nr, s->stroke_pos, status->gridsize);
-            segment_destroy(s);e->s1=0;
+	    advance_stroke(status, &status->queue, 0, s->stroke, s->polygon_nr, s->stroke_pos);
+            segment_destroy(status, s);e->s1=0;
             break;
         }
         case EVENT_END: {
@@ -1436,7 +1508,7 @@ static void event_apply(status_t*status, event_t*e)
 	    /* schedule segment for xrow handling */
             s->left = 0; s->right = status->ending_segments;
             status->ending_segments = s;
-	    advance_stroke(&status->queue, 0, s->stroke, s->polygon_nr, s->stroke_pos, status->gridsize);
+	    advance_stroke(status, &status->queue, 0, s->stroke, s->polygon_nr, s->stroke_pos);
             break;
         }
         case EVENT_START: {
@@ -1501,22 +1573,26 @@ static void check_status(status_t*status)
 }
 #endif
 
-gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments)
+/* sweep over any number of polygons at once. Segments of polys[t] are passed
+   to the windrule with polygon nr t. */
+static gfxpoly_t* process_polygons(gfxpoly_t**polys, int num_polys, windrule_t*windrule, windcontext_t*context, moments_t*moments)
 {
-    current_polygon = poly1;
+    current_polygon = polys[0];
 
     status_t status;
     memset(&status, 0, sizeof(status_t));
-    status.gridsize = poly1->gridsize;
+    status.gridsize = polys[0]->gridsize;
     status.windrule = windrule;
     status.context = context;
     status.actlist = actlist_new();
+    arena_init(&status.events, sizeof(event_t));
+    arena_init(&status.segments, sizeof(segment_t));
 
     queue_init(&status.queue);
-    gfxpoly_enqueue(poly1, &status.queue, 0, /*polygon nr*/0);
-    if(poly2) {
-	assert(poly1->gridsize == poly2->gridsize);
-	gfxpoly_enqueue(poly2, &status.queue, 0, /*polygon nr*/1);
+    int t;
+    for(t=0;t<num_polys;t++) {
+	assert(polys[t]->gridsize == polys[0]->gridsize);
+	gfxpoly_enqueue(&status, polys[t], &status.queue, 0, /*polygon nr*/t);
     }
 
 #ifdef CHECKS
@@ -1556,7 +1632,8 @@ gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule
         do {
             xrow_add(status.xrow, e->p.x);
             event_apply(&status, e);
-	    event_free(e);
+	    event_free(&status, e);
+	    status.num_events++;
             e = queue_get(&status.queue);
         } while(e && status.y == e->p.y);
 
@@ -1590,8 +1667,15 @@ gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule
     horiz_destroy(&status.horiz);
     xrow_destroy(status.xrow);
 
+    gfxpoly_stats.sweeps++;
+    gfxpoly_stats.events += status.num_events;
+    gfxpoly_stats.segments += status.num_segments;
+    gfxpoly_stats.blocks += status.events.num_blocks + status.segments.num_blocks;
+    arena_destroy(&status.events);
+    arena_destroy(&status.segments);
+
     gfxpoly_t*p = (gfxpoly_t*)malloc(sizeof(gfxpoly_t));
-    p->gridsize = poly1->gridsize;
+    p->gridsize = status.gridsize;
     p->strokes = status.strokes;
 
 #ifdef CHECKS
@@ -1606,6 +1690,12 @@ gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule
     return p;
 }
 
+gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments)
+{
+    gfxpoly_t*polys[2] = {poly1, poly2};
+    return process_polygons(polys, poly2?2:1, windrule, context, moments);
+}
+
 static windcontext_t onepolygon = {1};
 static windcontext_t twopolygons = {2};
 gfxpoly_t* gfxpoly_intersect(gfxpoly_t*p1, gfxpoly_t*p2)
@@ -1616,6 +1706,25 @@ gfxpoly_t* gfxpoly_union(gfxpoly_t*p1, gfxpoly_t*p2)
 {
     return gfxpoly_process(p1, p2, &windrule_union, &twopolygons, 0);
 }
+gfxpoly_t* gfxpoly_union_many(gfxpoly_t**polys, int num_polys)
+{
+    /* Unlike gfxpoly_union(), which keeps one bit per polygon, do this
+       with a winding number: Make every polygon consistently oriented
+       first, so that its inside has winding number 1 (the output of a sweep
+       always is), and the union is then everything with a non-zero
+       winding number. */
+    gfxpoly_t**normalized = (gfxpoly_t**)malloc(sizeof(gfxpoly_t*)*num_polys);
+    int t;
+    for(t=0;t<num_polys;t++) {
+	normalized[t] = gfxpoly_process(polys[t], 0, &windrule_evenodd, &onepolygon, 0);
+    }
+    gfxpoly_t*u = process_polygons(normalized, num_polys, &windrule_circular, &onepolygon, 0);
+    for(t=0;t<num_polys;t++) {
+	gfxpoly_destroy(normalized[t]);
+    }
+    free(normalized);
+    return u;
+}
 double gfxpoly_area(gfxpoly_t*p)
 {
     moments_t moments;
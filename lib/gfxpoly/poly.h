@@ -36,11 +36,15 @@ typedef struct _gfxpoly {
 } gfxpoly_t;
 
 typedef struct _segment {
+    /* fields used by the sweep for every comparison and xpos calculation come first,
+       so that they share a cache line. */
     point_t a;
     point_t b;
     point_t delta;
     double k; //k = a.x*b.y-a.y*b.x = delta.y*a.x - delta.x*a.y (=0 for points on the segment)
     int32_t minx, maxx;
+    struct _segment*left;
+    struct _segment*right;
     
     segment_dir_t dir;
     edgestyle_t*fs;
@@ -58,8 +62,6 @@ typedef struct _segment {
     struct _segment*leftchild;
     struct _segment*rightchild;
 #endif
-    struct _segment*left;
-    struct _segment*right;
     char changed;
 
     point_t pos;
@@ -77,6 +79,15 @@ typedef struct _moments {
     double m[3][3];
 } moments_t;
 
+/* counters, accumulated over all sweeps since the program started */
+typedef struct _gfxpoly_stats {
+    long sweeps;
+    long events;
+    long segments;
+    long blocks; // memory blocks allocated for events and segments
+} gfxpoly_stats_t;
+extern gfxpoly_stats_t gfxpoly_stats;
+
 #define LINE_EQ(p,s) ((double)(s)->delta.y*(p).x - (double)(s)->delta.x*(p).y - (s)->k)
 
 /* x1 + ((x2-x1)*(y-y1)) / dy = 
@@ -105,6 +116,7 @@ gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule
 
 gfxpoly_t* gfxpoly_intersect(gfxpoly_t*p1, gfxpoly_t*p2);
 gfxpoly_t* gfxpoly_union(gfxpoly_t*p1, gfxpoly_t*p2);
+gfxpoly_t* gfxpoly_union_many(gfxpoly_t**polys, int num_polys);
 double gfxpoly_area(gfxpoly_t*p);
 double gfxpoly_intersection_area(gfxpoly_t*p1, gfxpoly_t*p2);
 
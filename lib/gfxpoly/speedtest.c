@@ -2,8 +2,15 @@
 #include <stdio.h>
 #include <memory.h>
 #include <math.h>
-#include <sys/times.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "../gfxtools.h"
+#include "../gfxfont.h"
+#include "../args.h"
 #include "poly.h"
 #include "convert.h"
 #include "renderpoly.h"
@@ -111,7 +118,62 @@ gfxline_t* make_circles(gfxline_t*b, int n)
 static windcontext_t onepolygon = {1};
 static windcontext_t twopolygons = {2};
 
-int test_speed()
+#define GRIDSIZE 0.05
+
+/* the input of one benchmark. Depending on the operation, items are either
+   polygons or (for stroke expansion) lines. */
+typedef struct _corpus {
+    gfxpoly_t**polys;
+    int num_polys;
+    gfxline_t**lines;
+    int num_lines;
+    int num_segments;
+} corpus_t;
+
+typedef struct _benchmark {
+    const char*name;
+    const char*description;
+    char (*prepare)(corpus_t*corpus, int size);
+    /* runs the operation once over the whole corpus, returns the number of
+       segments in the output */
+    int (*run)(corpus_t*corpus);
+} benchmark_t;
+
+static void corpus_add_poly(corpus_t*c, gfxpoly_t*poly)
+{
+    c->polys = rfx_realloc(c->polys, sizeof(gfxpoly_t*)*(c->num_polys+1));
+    c->polys[c->num_polys++] = poly;
+    c->num_segments += gfxpoly_size(poly);
+}
+static void corpus_add_line(corpus_t*c, gfxline_t*line)
+{
+    c->lines = rfx_realloc(c->lines, sizeof(gfxline_t*)*(c->num_lines+1));
+    c->lines[c->num_lines++] = line;
+    for(;line;line=line->next) {
+	if(line->type != gfx_moveTo)
+	    c->num_segments++;
+    }
+}
+static void corpus_clear(corpus_t*c)
+{
+    int t;
+    for(t=0;t<c->num_polys;t++)
+	gfxpoly_destroy(c->polys[t]);
+    for(t=0;t<c->num_lines;t++)
+	gfxline_free(c->lines[t]);
+    if(c->polys) rfx_free(c->polys);
+    if(c->lines) rfx_free(c->lines);
+    memset(c, 0, sizeof(corpus_t));
+}
+
+/* ------------------------------ corpus ------------------------------- */
+
+static char*fontfile = 0;
+static char**dumpfiles = 0;
+static int num_dumpfiles = 0;
+
+/* the chessboard from above, rotated in 10 degree steps */
+static char prepare_chessboard(corpus_t*c, int size)
 {
     gfxline_t* b = mkchessboard();
     b = make_circles(b, 30);
@@ -119,32 +181,523 @@ int test_speed()
     gfxmatrix_t m;
     memset(&m, 0, sizeof(gfxmatrix_t));
     int t;
-    for(t=0;t<360;t++) {
-	//printf("%d\n", t);
-	m.m00 = cos(t*M_PI/180.0);
-	m.m01 = sin(t*M_PI/180.0);
-	m.m10 = -sin(t*M_PI/180.0);
-	m.m11 = cos(t*M_PI/180.0);
+    for(t=0;t<36*size;t++) {
+	double a = t*10*M_PI/180.0;
+	m.m00 = cos(a);
+	m.m01 = sin(a);
+	m.m10 = -sin(a);
+	m.m11 = cos(a);
 	m.tx = 400*1.41/2;
 	m.ty = 400*1.41/2;
 	gfxline_t*l = gfxline_clone(b);
 	gfxline_transform(l, &m);
-	gfxpoly_t*poly = gfxpoly_from_fill(b, 0.05);
-
-	gfxpoly_t*poly2 = gfxpoly_process(poly, 0, &windrule_evenodd, &onepolygon, 0);
-	gfxpoly_destroy(poly);
-	gfxpoly_destroy(poly2);
+	corpus_add_poly(c, gfxpoly_from_fill(l, GRIDSIZE));
 	gfxline_free(l);
     }
     gfxline_free(b);
+    return 1;
 }
 
-int main(int argn, char*argv[])
+/* lines of text: the outlines of 100*size glyphs of a real font, set a
+   little tighter than the font would, so that neighbouring glyphs overlap */
+static char prepare_glyphs(corpus_t*c, int size)
 {
-    struct tms t1,t2;
-    times(&t1);
-    test_speed();
-    times(&t2);
-    printf("%d\n", t2.tms_utime - t1.tms_utime);
+    if(!fontfile) {
+	fprintf(stderr, "glyphs: no font given (-f), skipping\n");
+	return 0;
+    }
+    gfxfont_t*font = gfxfont_load("font", fontfile, 0, 1.0);
+    if(!font || !font->num_glyphs) {
+	fprintf(stderr, "glyphs: couldn't load any glyphs from %s\n", fontfile);
+	return 0;
+    }
+    gfxbbox_t bbox = {0,0,0,0};
+    int t, with_outline = 0;
+    for(t=0;t<font->num_glyphs;t++) {
+	if(font->glyphs[t].line) {
+	    bbox = gfxbbox_expand_to_bbox(bbox, gfxline_getbbox(font->glyphs[t].line));
+	    with_outline++;
+	}
+    }
+    if(!with_outline) {
+	fprintf(stderr, "glyphs: %s has no glyph outlines\n", fontfile);
+	gfxfont_free(font);
+	return 0;
+    }
+    double height = bbox.ymax - bbox.ymin;
+    if(height <= 0) height = 1;
+    gfxmatrix_t m;
+    memset(&m, 0, sizeof(gfxmatrix_t));
+    m.m00 = m.m11 = 12.0 / height;
+
+    gfxline_t*page = 0;
+    double x = 0;
+    int num = 0;
+    for(t=0;num<100*size;t=(t+1)%font->num_glyphs) {
+	gfxglyph_t*glyph = &font->glyphs[t];
+	if(!glyph->line)
+	    continue;
+	gfxline_t*l = gfxline_clone(glyph->line);
+	m.tx = x;
+	m.ty = (num/60)*10;
+	gfxline_transform(l, &m);
+	page = gfxline_append(page, l);
+	x = (num%60==59) ? 0 : x + glyph->advance*m.m00*0.8;
+	num++;
+    }
+    gfxfont_free(font);
+    corpus_add_poly(c, gfxpoly_from_fill(page, GRIDSIZE));
+    gfxline_free(page);
+    return 1;
 }
 
+/* pseudo random zig-zag lines, each 200 segments long. These are expanded
+   with gfxpoly_from_stroke */
+static char prepare_strokes(corpus_t*c, int size)
+{
+    unsigned int r = 0;
+    int t, s;
+    for(t=0;t<10*size;t++) {
+	gfxline_t*l = (gfxline_t*)rfx_calloc(sizeof(gfxline_t)*201);
+	double x = 0, y = t*8;
+	for(s=0;s<=200;s++) {
+	    r = crc32_add_byte(r, s);
+	    r = crc32_add_byte(r, t);
+	    x += 2 + (r%8);
+	    y += ((int)((r>>8)%21) - 10) * 0.5;
+	    l[s].type = s ? gfx_lineTo : gfx_moveTo;
+	    l[s].x = x;
+	    l[s].y = y;
+	    l[s].next = s<200 ? &l[s+1] : 0;
+	}
+	corpus_add_line(c, l);
+    }
+    return 1;
+}
+
+/* a map: a grid of (20*size)^2 jittered quadrilaterals which share their
+   edges with their neighbours, unioned into one area */
+static char prepare_map(corpus_t*c, int size)
+{
+    int n = 20*size;
+    double*px = (double*)rfx_alloc(sizeof(double)*(n+1)*(n+1));
+    double*py = (double*)rfx_alloc(sizeof(double)*(n+1)*(n+1));
+    unsigned int r = 0;
+    int x,y;
+    for(y=0;y<=n;y++)
+    for(x=0;x<=n;x++) {
+	r = crc32_add_byte(r, x);
+	r = crc32_add_byte(r, y);
+	px[y*(n+1)+x] = x*10 + (int)(r%7) - 3;
+	py[y*(n+1)+x] = y*10 + (int)((r>>4)%7) - 3;
+    }
+    gfxline_t*map = 0;
+    for(y=0;y<n;y++)
+    for(x=0;x<n;x++) {
+	int i[5] = {y*(n+1)+x, y*(n+1)+x+1, (y+1)*(n+1)+x+1, (y+1)*(n+1)+x, y*(n+1)+x};
+	gfxline_t*l = (gfxline_t*)rfx_calloc(sizeof(gfxline_t)*5);
+	int t;
+	for(t=0;t<5;t++) {
+	    l[t].type = t ? gfx_lineTo : gfx_moveTo;
+	    l[t].x = px[i[t]];
+	    l[t].y = py[i[t]];
+	    l[t].next = t<4 ? &l[t+1] : 0;
+	}
+	map = gfxline_append(map, l);
+    }
+    rfx_free(px);
+    rfx_free(py);
+    corpus_add_poly(c, gfxpoly_from_fill(map, GRIDSIZE));
+    gfxline_free(map);
+    return 1;
+}
+
+/* reads a polygon written by gfxpoly_save(). That stores integer grid
+   coordinates, with the points of every stroke sorted by y, and the
+   original stroke direction encoded in the gray value. */
+static gfxpoly_t* load_dump(const char*filename)
+{
+    FILE*fi = fopen(filename, "rb");
+    if(!fi) {
+	perror(filename);
+	return 0;
+    }
+    gfxpoly_t*poly = (gfxpoly_t*)rfx_calloc(sizeof(gfxpoly_t));
+    poly->gridsize = 1.0;
+    segment_dir_t dir = DIR_DOWN;
+    gfxpolystroke_t*stroke = 0;
+    char line[256];
+    while(fgets(line, sizeof(line), fi)) {
+	double g;
+	int x,y;
+	char cmd[32];
+	if(sscanf(line, "%% gridsize %lf", &g) == 1) {
+	    poly->gridsize = g;
+	} else if(sscanf(line, "%lf %31s", &g, cmd) == 2 && !strcmp(cmd, "setgray")) {
+	    dir = g>0.5 ? DIR_UP : DIR_DOWN;
+	} else if(sscanf(line, "%d %d %31s", &x, &y, cmd) == 3) {
+	    if(!strcmp(cmd, "moveto")) {
+		stroke = (gfxpolystroke_t*)rfx_calloc(sizeof(gfxpolystroke_t));
+		stroke->fs = &edgestyle_default;
+		stroke->dir = dir;
+		stroke->points_size = 16;
+		stroke->points = (point_t*)rfx_alloc(sizeof(point_t)*stroke->points_size);
+		stroke->next = poly->strokes;
+		poly->strokes = stroke;
+	    } else if(!stroke || strcmp(cmd, "lineto")) {
+		continue;
+	    }
+	    if(stroke->num_points == stroke->points_size) {
+		stroke->points_size *= 2;
+		stroke->points = (point_t*)rfx_realloc(stroke->points, sizeof(point_t)*stroke->points_size);
+	    }
+	    stroke->points[stroke->num_points].x = x;
+	    stroke->points[stroke->num_points].y = y;
+	    stroke->num_points++;
+	}
+    }
+    fclose(fi);
+
+    /* drop degenerate strokes, the sweep can't handle them */
+    gfxpolystroke_t**s = &poly->strokes;
+    while(*s) {
+	if((*s)->num_points < 2) {
+	    gfxpolystroke_t*next = (*s)->next;
+	    rfx_free((*s)->points);
+	    rfx_free(*s);
+	    *s = next;
+	} else {
+	    s = &(*s)->next;
+	}
+    }
+    return poly;
+}
+
+/* a clip stack: the dumped polygons given on the command line, intersected
+   with each other in order */
+static char prepare_clips(corpus_t*c, int size)
+{
+    if(!num_dumpfiles) {
+	fprintf(stderr, "clips: no gfxpoly_save() dumps given, skipping\n");
+	return 0;
+    }
+    int t;
+    for(t=0;t<num_dumpfiles;t++) {
+	gfxpoly_t*poly = load_dump(dumpfiles[t]);
+	if(!poly) {
+	    corpus_clear(c);
+	    return 0;
+	}
+	if(c->num_polys && poly->gridsize != c->polys[0]->gridsize) {
+	    fprintf(stderr, "clips: %s has a different gridsize than %s\n", dumpfiles[t], dumpfiles[0]);
+	    gfxpoly_destroy(poly);
+	    corpus_clear(c);
+	    return 0;
+	}
+	corpus_add_poly(c, poly);
+    }
+    return 1;
+}
+
+/* ---------------------------- operations ----------------------------- */
+
+static int run_evenodd(corpus_t*c)
+{
+    int t, segments = 0;
+    for(t=0;t<c->num_polys;t++) {
+	gfxpoly_t*poly = gfxpoly_process(c->polys[t], 0, &windrule_evenodd, &onepolygon, 0);
+	segments += gfxpoly_size(poly);
+	gfxpoly_destroy(poly);
+    }
+    return segments;
+}
+static int run_circular(corpus_t*c)
+{
+    int t, segments = 0;
+    for(t=0;t<c->num_polys;t++) {
+	gfxpoly_t*poly = gfxpoly_process(c->polys[t], 0, &windrule_circular, &onepolygon, 0);
+	segments += gfxpoly_size(poly);
+	gfxpoly_destroy(poly);
+    }
+    return segments;
+}
+static int run_stroke(corpus_t*c)
+{
+    int t, segments = 0;
+    for(t=0;t<c->num_lines;t++) {
+	gfxpoly_t*poly = gfxpoly_from_stroke(c->lines[t], 3.0, gfx_capRound, gfx_joinRound, 4.0, GRIDSIZE);
+	segments += gfxpoly_size(poly);
+	gfxpoly_destroy(poly);
+    }
+    return segments;
+}
+static int run_clipstack(corpus_t*c)
+{
+    gfxpoly_t*clip = gfxpoly_process(c->polys[0], 0, &windrule_evenodd, &onepolygon, 0);
+    int t;
+    for(t=1;t<c->num_polys;t++) {
+	gfxpoly_t*poly = gfxpoly_process(clip, c->polys[t], &windrule_intersect, &twopolygons, 0);
+	gfxpoly_destroy(clip);
+	clip = poly;
+    }
+    int segments = gfxpoly_size(clip);
+    gfxpoly_destroy(clip);
+    return segments;
+}
+
+static benchmark_t benchmarks[] = {
+    {"chessboard", "overlapping boxes, diamonds and circles, evenodd", prepare_chessboard, run_evenodd},
+    {"glyphs", "glyph outlines from a font file, evenodd", prepare_glyphs, run_evenodd},
+    {"strokes", "stroke expansion of zig-zag lines", prepare_strokes, run_stroke},
+    {"map", "jittered grid of adjacent cells, nonzero", prepare_map, run_circular},
+    {"clips", "intersection of a stack of gfxpoly_save() dumps", prepare_clips, run_clipstack},
+};
+#define NUM_BENCHMARKS (sizeof(benchmarks)/sizeof(benchmarks[0]))
+
+/* ---------------------------- measuring ------------------------------ */
+
+static int64_t time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec*1000000000ll + ts.tv_nsec;
+}
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+static int compare_int64(const void*a, const void*b)
+{
+    int64_t d = *(int64_t*)a - *(int64_t*)b;
+    return d<0?-1:(d>0?1:0);
+}
+
+typedef struct _result {
+    const char*name;
+    int input_segments;
+    int output_segments;
+    int64_t min_ns;
+    int64_t median_ns;
+    long events;
+    long blocks;
+    long peak_rss_kb;
+} result_t;
+
+static char*only = 0;
+static int size = 1;
+static int repeats = 5;
+static int warmup = 1;
+static char*jsonfile = 0;
+
+static char run_benchmark(benchmark_t*b, result_t*r)
+{
+    corpus_t corpus;
+    memset(&corpus, 0, sizeof(corpus));
+    if(!b->prepare(&corpus, size))
+	return 0;
+
+    memset(r, 0, sizeof(result_t));
+    r->name = b->name;
+    r->input_segments = corpus.num_segments;
+
+    int t;
+    for(t=0;t<warmup;t++) {
+	b->run(&corpus);
+    }
+    int64_t*times = (int64_t*)rfx_alloc(sizeof(int64_t)*repeats);
+    long events = gfxpoly_stats.events;
+    long blocks = gfxpoly_stats.blocks;
+    for(t=0;t<repeats;t++) {
+	int64_t start = time_ns();
+	r->output_segments = b->run(&corpus);
+	times[t] = time_ns() - start;
+    }
+    r->events = (gfxpoly_stats.events - events) / repeats;
+    r->blocks = (gfxpoly_stats.blocks - blocks) / repeats;
+    qsort(times, repeats, sizeof(int64_t), compare_int64);
+    r->min_ns = times[0];
+    r->median_ns = times[repeats/2];
+    rfx_free(times);
+    corpus_clear(&corpus);
+    r->peak_rss_kb = peak_rss_kb();
+    return 1;
+}
+
+/* ru_maxrss is the peak of the whole process, so every benchmark runs in a
+   child process of its own, which sends its result back through a pipe */
+static char run_benchmark_forked(benchmark_t*b, result_t*r)
+{
+    int fd[2];
+    if(pipe(fd) < 0)
+	return run_benchmark(b, r);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if(pid < 0) {
+	close(fd[0]);
+	close(fd[1]);
+	return run_benchmark(b, r);
+    }
+    if(!pid) {
+	close(fd[0]);
+	char ok = run_benchmark(b, r);
+	if(ok && write(fd[1], r, sizeof(result_t)) != sizeof(result_t))
+	    ok = 0;
+	_exit(ok?0:1);
+    }
+    close(fd[1]);
+    int len = read(fd[0], r, sizeof(result_t));
+    close(fd[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return len == sizeof(result_t) && WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+static double per_segment(result_t*r)
+{
+    return r->input_segments ? (double)r->median_ns / r->input_segments : 0;
+}
+
+static void print_result(FILE*fi, result_t*r)
+{
+    fprintf(fi, "%-12s %8d segs -> %8d segs  %9.3f ms (min %9.3f ms)  %7.1f ns/seg  %8.0f events/sec  %7ld allocs  %6ld kB peak\n",
+	    r->name, r->input_segments, r->output_segments,
+	    r->median_ns / 1000000.0, r->min_ns / 1000000.0, per_segment(r),
+	    r->median_ns ? r->events * 1e9 / r->median_ns : 0.0, r->blocks, r->peak_rss_kb);
+}
+
+static void write_json(FILE*fi, result_t*results, int num)
+{
+    fprintf(fi, "{\n");
+    fprintf(fi, "  \"size\": %d,\n", size);
+    fprintf(fi, "  \"repeats\": %d,\n", repeats);
+    fprintf(fi, "  \"warmup\": %d,\n", warmup);
+    fprintf(fi, "  \"benchmarks\": [");
+    int t;
+    for(t=0;t<num;t++) {
+	result_t*r = &results[t];
+	fprintf(fi, "%s\n    {\"name\": \"%s\", \"input_segments\": %d, \"output_segments\": %d, "
+		    "\"median_ns\": %lld, \"min_ns\": %lld, \"ns_per_segment\": %.2f, "
+		    "\"events\": %ld, \"blocks\": %ld, \"peak_rss_kb\": %ld}",
+		t?",":"", r->name, r->input_segments, r->output_segments,
+		(long long)r->median_ns, (long long)r->min_ns, per_segment(r),
+		r->events, r->blocks, r->peak_rss_kb);
+    }
+    fprintf(fi, "\n  ]\n}\n");
+}
+
+static struct options_t options[] = {
+{"h", "help"},
+{"b", "benchmark"},
+{"n", "size"},
+{"r", "repeats"},
+{"w", "warmup"},
+{"f", "font"},
+{"o", "output"},
+{0,0}
+};
+
+int args_callback_option(char*name,char*val)
+{
+    if(!strcmp(name, "b")) {
+	only = val;
+	return 1;
+    } else if(!strcmp(name, "n")) {
+	size = atoi(val);
+	if(size<1) size = 1;
+	return 1;
+    } else if(!strcmp(name, "r")) {
+	repeats = atoi(val);
+	if(repeats<1) repeats = 1;
+	return 1;
+    } else if(!strcmp(name, "w")) {
+	warmup = atoi(val);
+	if(warmup<0) warmup = 0;
+	return 1;
+    } else if(!strcmp(name, "f")) {
+	fontfile = val;
+	return 1;
+    } else if(!strcmp(name, "o")) {
+	jsonfile = val;
+	return 1;
+    } else if(!strcmp(name, "h")) {
+	args_callback_usage(0);
+	exit(0);
+    } else {
+	fprintf(stderr, "Unknown option: -%s\n", name);
+	exit(1);
+    }
+    return 0;
+}
+int args_callback_longoption(char*name,char*val)
+{
+    return args_long2shortoption(options, name, val);
+}
+void args_callback_usage(char *name)
+{
+    printf("\n");
+    printf("Usage: speedtest [-b benchmark] [-n size] [-r repeats] [-w warmup] [-f font.ttf] [-o results.json] [dump.ps ...]\n");
+    printf("\n");
+    printf("-h , --help                    Print short help message and exit\n");
+    printf("-b , --benchmark <name>        Only run the given benchmark\n");
+    printf("-n , --size <n>                Scale the size of the generated inputs (default: 1)\n");
+    printf("-r , --repeats <n>             Measure every benchmark n times (default: 5)\n");
+    printf("-w , --warmup <n>              Run every benchmark n times before measuring (default: 1)\n");
+    printf("-f , --font <file>             Font to take glyph outlines from\n");
+    printf("-o , --output <file>           Write the results as JSON to <file> (- for stdout)\n");
+    printf("\n");
+    printf("Files given on the command line are polygons written by gfxpoly_save(),\n");
+    printf("which the \"clips\" benchmark intersects with each other.\n");
+    printf("\n");
+    printf("Benchmarks:\n");
+    int t;
+    for(t=0;t<NUM_BENCHMARKS;t++) {
+	printf("  %-12s %s\n", benchmarks[t].name, benchmarks[t].description);
+    }
+    printf("\n");
+}
+int args_callback_command(char*name,char*val)
+{
+    dumpfiles = (char**)rfx_realloc(dumpfiles, sizeof(char*)*(num_dumpfiles+1));
+    dumpfiles[num_dumpfiles++] = name;
+    return 0;
+}
+
+int main(int argn, char*argv[])
+{
+    processargs(argn, argv);
+
+    FILE*out = stdout;
+    if(jsonfile && !strcmp(jsonfile, "-"))
+	out = stderr;
+
+    result_t results[NUM_BENCHMARKS];
+    int num = 0;
+    int t;
+    for(t=0;t<NUM_BENCHMARKS;t++) {
+	if(only && strcmp(only, benchmarks[t].name))
+	    continue;
+	if(run_benchmark_forked(&benchmarks[t], &results[num])) {
+	    print_result(out, &results[num]);
+	    num++;
+	}
+    }
+    if(only && !num) {
+	fprintf(stderr, "Benchmark %s not found or not runnable\n", only);
+	return 1;
+    }
+
+    if(jsonfile) {
+	FILE*fi = strcmp(jsonfile, "-") ? fopen(jsonfile, "wb") : stdout;
+	if(!fi) {
+	    perror(jsonfile);
+	    return 1;
+	}
+	write_json(fi, results, num);
+	if(fi != stdout)
+	    fclose(fi);
+    }
+    return 0;
+}
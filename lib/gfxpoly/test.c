@@ -346,6 +346,44 @@ int test_area()
     }
 }
 
+int test_union_many()
+{
+    /* compare gfxpoly_union_many() against merging the polygons one by one */
+    int num = 200;
+    gfxpoly_t**polys = (gfxpoly_t**)malloc(sizeof(gfxpoly_t*)*num);
+    gfxpoly_t*u1 = gfxpoly_from_fill(0, 0.05);
+    int t;
+    for(t=0;t<num;t++) {
+        int x1 = lrand48()%400;
+        int y1 = lrand48()%400;
+        gfxline_t*line = gfxline_makerectangle(x1, y1, x1+5+lrand48()%50, y1+5+lrand48()%50);
+        polys[t] = gfxpoly_from_fill(line, 0.05);
+        gfxline_free(line);
+
+        gfxpoly_t*old = u1;
+        u1 = gfxpoly_union(polys[t], old);
+        gfxpoly_destroy(old);
+    }
+    gfxpoly_t*u2 = gfxpoly_union_many(polys, num);
+    double area1 = gfxpoly_area(u1);
+    double area2 = gfxpoly_area(u2);
+    double area12 = gfxpoly_intersection_area(u1, u2);
+    printf("%f %f %f\n", area1, area2, area12);
+
+    /* the rectangles are on the grid, so all three should be the same area,
+       save for rounding */
+    double tolerance = 0.05*0.05*num;
+    assert(fabs(area1 - area2) <= tolerance);
+    assert(fabs(area1 - area12) <= tolerance);
+
+    for(t=0;t<num;t++) {
+        gfxpoly_destroy(polys[t]);
+    }
+    free(polys);
+    gfxpoly_destroy(u1);
+    gfxpoly_destroy(u2);
+}
+
 int test2(int argn, char*argv[])
 {
     test_square(400,400, 3, 0.05, 1);
@@ -716,5 +754,6 @@ void test5(int argn, char*argv[])
 int main(int argn, char*argv[])
 {
     test_area(argn, argv);
+    test_union_many();
 }
 
@@ -133,6 +133,255 @@ void gfxdrawer_target_gfxline(gfxdrawer_t*d)
     d->result = linedraw_result;
 }
 
+typedef struct _gfxarena_chunk
+{
+    struct _gfxarena_chunk*next;
+    int size;
+    int pos;
+} gfxarena_chunk_t;
+
+struct _gfxarena
+{
+    gfxarena_chunk_t*first;
+    gfxarena_chunk_t*current;
+};
+
+#define ARENA_CHUNK_SIZE 65536
+
+gfxarena_t* gfxarena_new()
+{
+    return (gfxarena_t*)rfx_calloc(sizeof(gfxarena_t));
+}
+
+void* gfxarena_alloc(gfxarena_t*a, int size)
+{
+    size = (size+7)&~7;
+    gfxarena_chunk_t*c = a->current;
+    while(c && c->pos + size > c->size) {
+	/* chunks after the current one are empty, as they were reset */
+	c = c->next;
+    }
+    if(!c) {
+	int chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+	c = (gfxarena_chunk_t*)rfx_alloc(sizeof(gfxarena_chunk_t) + chunk_size);
+	c->next = 0;
+	c->size = chunk_size;
+	c->pos = 0;
+	if(a->current) {
+	    c->next = a->current->next;
+	    a->current->next = c;
+	} else {
+	    c->next = a->first;
+	    a->first = c;
+	}
+    }
+    a->current = c;
+    void*mem = (char*)(c+1) + c->pos;
+    c->pos += size;
+    return mem;
+}
+
+void gfxarena_reset(gfxarena_t*a)
+{
+    gfxarena_chunk_t*c = a->first;
+    while(c) {
+	c->pos = 0;
+	c = c->next;
+    }
+    a->current = a->first;
+}
+
+void gfxarena_destroy(gfxarena_t*a)
+{
+    gfxarena_chunk_t*c = a->first;
+    while(c) {
+	gfxarena_chunk_t*next = c->next;
+	rfx_free(c);
+	c = next;
+    }
+    rfx_free(a);
+}
+
+gfxpath_t* gfxpath_new(gfxarena_t*arena)
+{
+    gfxpath_t*path = (gfxpath_t*)gfxarena_alloc(arena, sizeof(gfxpath_t));
+    memset(path, 0, sizeof(gfxpath_t));
+    path->arena = arena;
+    return path;
+}
+
+static void gfxpath_grow(gfxpath_t*path)
+{
+    int size = path->size ? path->size*2 : 32;
+    unsigned char*type = (unsigned char*)gfxarena_alloc(path->arena, size);
+    gfxcoord_t*coords = (gfxcoord_t*)gfxarena_alloc(path->arena, sizeof(gfxcoord_t)*size*4);
+    if(path->num) {
+	memcpy(type, path->type, path->num);
+	memcpy(coords, path->x, sizeof(gfxcoord_t)*path->num);
+	memcpy(coords+size, path->y, sizeof(gfxcoord_t)*path->num);
+	memcpy(coords+size*2, path->sx, sizeof(gfxcoord_t)*path->num);
+	memcpy(coords+size*3, path->sy, sizeof(gfxcoord_t)*path->num);
+    }
+    path->type = type;
+    path->x = coords;
+    path->y = coords+size;
+    path->sx = coords+size*2;
+    path->sy = coords+size*3;
+    path->size = size;
+}
+
+void gfxpath_add(gfxpath_t*path, gfx_linetype type, gfxcoord_t x, gfxcoord_t y, gfxcoord_t sx, gfxcoord_t sy)
+{
+    if(path->num == path->size)
+	gfxpath_grow(path);
+    int n = path->num++;
+    path->type[n] = type;
+    path->x[n] = x;
+    path->y[n] = y;
+    path->sx[n] = sx;
+    path->sy[n] = sy;
+}
+
+gfxpath_t* gfxpath_from_gfxline(gfxarena_t*arena, gfxline_t*line)
+{
+    gfxpath_t*path = gfxpath_new(arena);
+    while(line) {
+	gfxpath_add(path, line->type, line->x, line->y, line->sx, line->sy);
+	line = line->next;
+    }
+    return path;
+}
+
+gfxline_t* gfxline_from_gfxpath(gfxpath_t*path)
+{
+    if(!path->num)
+	return 0;
+    gfxline_t*l = (gfxline_t*)rfx_alloc(sizeof(gfxline_t)*path->num);
+    int t;
+    for(t=0;t<path->num;t++) {
+	l[t].type = (gfx_linetype)path->type[t];
+	l[t].x = path->x[t];
+	l[t].y = path->y[t];
+	l[t].sx = path->sx[t];
+	l[t].sy = path->sy[t];
+	l[t].next = &l[t+1];
+    }
+    l[path->num-1].next = 0;
+    return l;
+}
+
+gfxbbox_t gfxpath_getbbox(gfxpath_t*path)
+{
+    gfxbbox_t bbox = {0,0,0,0};
+    char last = 0;
+    int t;
+    for(t=0;t<path->num;t++) {
+	if(path->type[t] == gfx_moveTo) {
+	    last = 1;
+	    continue;
+	}
+	if(last) 
+	    bbox = gfxbbox_expand_to_point(bbox, path->x[t-1], path->y[t-1]);
+	if(path->type[t] == gfx_splineTo)
+	    bbox = gfxbbox_expand_to_point(bbox, path->sx[t], path->sy[t]);
+	bbox = gfxbbox_expand_to_point(bbox, path->x[t], path->y[t]);
+	last = 0;
+    }
+    return bbox;
+}
+
+void gfxpath_transform(gfxpath_t*path, gfxmatrix_t*m)
+{
+    int t;
+    for(t=0;t<path->num;t++) {
+	double x = m->m00*path->x[t] + m->m10*path->y[t] + m->tx;
+	double y = m->m01*path->x[t] + m->m11*path->y[t] + m->ty;
+	path->x[t] = x;
+	path->y[t] = y;
+    }
+    for(t=0;t<path->num;t++) {
+	if(path->type[t] == gfx_splineTo) {
+	    double x = m->m00*path->sx[t] + m->m10*path->sy[t] + m->tx;
+	    double y = m->m01*path->sx[t] + m->m11*path->sy[t] + m->ty;
+	    path->sx[t] = x;
+	    path->sy[t] = y;
+	}
+    }
+}
+
+typedef struct _pathdraw_internal
+{
+    gfxpath_t*path;
+    gfxcoord_t x0,y0;
+    char has_moveto;
+} pathdraw_internal_t;
+
+static void pathdraw_moveTo(gfxdrawer_t*d, gfxcoord_t x, gfxcoord_t y)
+{
+    pathdraw_internal_t*i = (pathdraw_internal_t*)d->internal;
+    i->has_moveto = 1;
+    i->x0 = x;
+    i->y0 = y;
+    gfxpath_add(i->path, gfx_moveTo, x, y, 0, 0);
+    d->x = x;
+    d->y = y;
+}
+static void pathdraw_lineTo(gfxdrawer_t*d, gfxcoord_t x, gfxcoord_t y)
+{
+    pathdraw_internal_t*i = (pathdraw_internal_t*)d->internal;
+    if(!i->has_moveto) {
+	/* same as linedraw_lineTo() */
+	pathdraw_moveTo(d, x, y);
+	return;
+    }
+    gfxpath_add(i->path, gfx_lineTo, x, y, 0, 0);
+    d->x = x;
+    d->y = y;
+}
+static void pathdraw_splineTo(gfxdrawer_t*d, gfxcoord_t sx, gfxcoord_t sy, gfxcoord_t x, gfxcoord_t y)
+{
+    pathdraw_internal_t*i = (pathdraw_internal_t*)d->internal;
+    if(!i->has_moveto) {
+	pathdraw_moveTo(d, x, y);
+	return;
+    }
+    gfxpath_add(i->path, gfx_splineTo, x, y, sx, sy);
+    d->x = x;
+    d->y = y;
+}
+static void pathdraw_close(gfxdrawer_t*d)
+{
+    pathdraw_internal_t*i = (pathdraw_internal_t*)d->internal;
+    if(!i->has_moveto) 
+	return;
+    pathdraw_lineTo(d, i->x0, i->y0);
+    i->has_moveto = 0;
+    i->x0 = 0;
+    i->y0 = 0;
+}
+static void* pathdraw_result(gfxdrawer_t*d)
+{
+    pathdraw_internal_t*i = (pathdraw_internal_t*)d->internal;
+    gfxpath_t*result = i->path;
+    memset(d, 0, sizeof(gfxdrawer_t));
+    return result;
+}
+
+void gfxdrawer_target_gfxpath(gfxdrawer_t*d, gfxarena_t*arena)
+{
+    pathdraw_internal_t*i = (pathdraw_internal_t*)gfxarena_alloc(arena, sizeof(pathdraw_internal_t));
+    memset(i, 0, sizeof(pathdraw_internal_t));
+    i->path = gfxpath_new(arena);
+    d->x = 0x7fffffff;
+    d->y = 0x7fffffff;
+    d->internal = i;
+    d->moveTo = pathdraw_moveTo;
+    d->lineTo = pathdraw_lineTo;
+    d->splineTo = pathdraw_splineTo;
+    d->close = pathdraw_close;
+    d->result = pathdraw_result;
+}
+
 typedef struct _qspline_abc
 {
     double ax,bx,cx;
@@ -486,6 +735,58 @@ void gfxline_optimize(gfxline_t*line)
     }
 }
 
+void gfxpath_optimize(gfxpath_t*path)
+{
+    /* step 1: convert splines to lines, where possible */
+    double x=0,y=0;
+    int t;
+    for(t=0;t<path->num;t++) {
+	if(path->type[t] == gfx_splineTo) {
+	    gfxline_t l;
+	    l.type = gfx_splineTo;
+	    l.x = path->x[t]; l.y = path->y[t];
+	    l.sx = path->sx[t]; l.sy = path->sy[t];
+	    if(splineIsStraight(x,y,&l))
+		path->type[t] = gfx_lineTo;
+	}
+	x = path->x[t];
+	y = path->y[t];
+    }
+    if(!path->num)
+	return;
+    /* step 2: combine adjacent lines, where possible. This compacts
+       the arrays in place, with l the index of the current segment */
+    int l = 0;
+    for(t=1;t<path->num;t++) {
+	char combine = 0;
+	if(path->type[l] == gfx_lineTo && path->type[t] == gfx_lineTo) {
+	    double dx = path->x[l]-x;
+	    double dy = path->y[l]-y;
+	    double nx = path->x[t]-path->x[l];
+	    double ny = path->y[t]-path->y[l];
+	    if(fabs(dx*ny - dy*nx) < 0.000001 && (dx*nx + dy*ny) >= 0) {
+		combine = 1;
+	    }
+	}
+	if(combine) {
+	    path->x[l] = path->x[t];
+	    path->y[l] = path->y[t];
+	    path->sx[l] = 0;
+	    path->sy[l] = 0;
+	} else {
+	    x = path->x[l];
+	    y = path->y[l];
+	    l++;
+	    path->type[l] = path->type[t];
+	    path->x[l] = path->x[t];
+	    path->y[l] = path->y[t];
+	    path->sx[l] = path->sx[t];
+	    path->sy[l] = path->sy[t];
+	}
+    }
+    path->num = l+1;
+}
+
 gfxline_t* gfxtool_dash_line(gfxline_t*line, float*dashes, float phase)
 {
     gfxdrawer_t d;
@@ -858,51 +1159,105 @@ gfxfontlist_t* gfxfontlist_create()
     return 0;
 }
 
-gfxfont_t*gfxfontlist_findfont(gfxfontlist_t*list, char*id)
+typedef struct _gfxfontindex
 {
-    gfxfontlist_t*l = list;
-    while(l) {
-	if(!strcmp((char*)l->font->id, id)) {
-	    return l->font;
-	}
-	l = l->next;
+    gfxfontlist_t**buckets;
+    int size;
+    int num;
+    gfxfontlist_t*last;
+} gfxfontindex_t;
+
+static inline unsigned int fontid_hash(const char*id)
+{
+    return string_hash2(id?id:"");
+}
+static inline char fontid_equals(gfxfont_t*font, const char*id)
+{
+    return !strcmp(font->id?font->id:"", id?id:"");
+}
+
+static void fontindex_insert(gfxfontindex_t*index, gfxfontlist_t*l)
+{
+    /* append to the bucket, so that lookups find the first font
+       with a given id, like a walk through the list would */
+    gfxfontlist_t**b = &index->buckets[fontid_hash(l->font->id) % index->size];
+    while(*b)
+	b = &(*b)->hash_next;
+    l->hash_next = 0;
+    *b = l;
+}
+
+static void fontindex_grow(gfxfontlist_t*list)
+{
+    gfxfontindex_t*index = list->index;
+    gfxfontlist_t*l;
+    free(index->buckets);
+    index->size = index->size*2;
+    index->buckets = (gfxfontlist_t**)rfx_calloc(sizeof(gfxfontlist_t*)*index->size);
+    for(l=list;l;l=l->next) {
+	fontindex_insert(index, l);
     }
-    return 0;
 }
-char gfxfontlist_hasfont(gfxfontlist_t*list, gfxfont_t*font)
+
+static gfxfontlist_t* fontlist_lookup(gfxfontlist_t*list, const char*id)
 {
-    gfxfontlist_t*l = list;
-    while(l) {
-	if(!strcmp((char*)l->font->id, font->id)) {
-	    return 1;
+    gfxfontlist_t*l;
+    if(!list)
+	return 0;
+    if(list->index) {
+	l = list->index->buckets[fontid_hash(id) % list->index->size];
+	while(l) {
+	    if(fontid_equals(l->font, id))
+		return l;
+	    l = l->hash_next;
 	}
-	l = l->next;
+	return 0;
+    }
+    /* not the start of a list- do a linear search */
+    for(l=list;l;l=l->next) {
+	if(fontid_equals(l->font, id))
+	    return l;
     }
     return 0;
 }
+
+gfxfont_t*gfxfontlist_findfont(gfxfontlist_t*list, char*id)
+{
+    gfxfontlist_t*l = fontlist_lookup(list, id);
+    return l?l->font:0;
+}
+char gfxfontlist_hasfont(gfxfontlist_t*list, gfxfont_t*font)
+{
+    return fontlist_lookup(list, font->id)!=0;
+}
 void*gfxfontlist_getuserdata(gfxfontlist_t*list, const char*id)
 {
-    gfxfontlist_t*l = list;
-    while(l) {
-	if(!strcmp((char*)l->font->id, id)) {
-	    return l->user;
-	}
-	l = l->next;
-    }
-    return 0;
+    gfxfontlist_t*l = fontlist_lookup(list, id);
+    return l?l->user:0;
 }
 gfxfontlist_t*gfxfontlist_addfont2(gfxfontlist_t*list, gfxfont_t*font, void*user)
 {
     gfxfontlist_t*last=0,*l = list;
-    while(l) {
-	last = l;
-	if(l->font == font) {
-	    return list; // we already know this font
-	}
-	l = l->next;
-    }
     if(!font) {
 	fprintf(stderr, "Tried to add zero font\n");
+	return list;
+    }
+    if(list && list->index) {
+	/* a font which is already in the list has the same id */
+	for(l=list->index->buckets[fontid_hash(font->id) % list->index->size];l;l=l->hash_next) {
+	    if(l->font == font) {
+		return list; // we already know this font
+	    }
+	}
+	last = list->index->last;
+    } else {
+	while(l) {
+	    last = l;
+	    if(l->font == font) {
+		return list; // we already know this font
+	    }
+	    l = l->next;
+	}
     }
     l = (gfxfontlist_t*)rfx_calloc(sizeof(gfxfontlist_t));
     l->font = font;
@@ -910,10 +1265,22 @@ gfxfontlist_t*gfxfontlist_addfont2(gfxfontlist_t*list, gfxfont_t*font, void*user
     l->next = 0;
     if(last) {
 	last->next = l;
-	return list;
     } else {
-	return l;
+	list = l;
+	list->index = (gfxfontindex_t*)rfx_calloc(sizeof(gfxfontindex_t));
+	list->index->size = 16;
+	list->index->buckets = (gfxfontlist_t**)rfx_calloc(sizeof(gfxfontlist_t*)*list->index->size);
     }
+    if(list->index) {
+	gfxfontindex_t*index = list->index;
+	index->last = l;
+	if(++index->num > index->size) {
+	    fontindex_grow(list);
+	} else {
+	    fontindex_insert(index, l);
+	}
+    }
+    return list;
 }
 gfxfontlist_t*gfxfontlist_addfont(gfxfontlist_t*list, gfxfont_t*font)
 {
@@ -922,6 +1289,11 @@ gfxfontlist_t*gfxfontlist_addfont(gfxfontlist_t*list, gfxfont_t*font)
 void gfxfontlist_free(gfxfontlist_t*list, char deletefonts)
 {
     gfxfontlist_t*l = list;
+    if(l && l->index) {
+	free(l->index->buckets);
+	free(l->index);
+	l->index = 0;
+    }
     while(l) {
 	gfxfontlist_t*next = l->next;
 	if(deletefonts && l->font) {
@@ -52,10 +52,49 @@ typedef struct _gfxfontlist
     gfxfont_t*font;
     void*user;
     struct _gfxfontlist*next;
+
+    /* lookup by font id. The index is only stored in the first element
+       of a list; hash_next chains elements within one bucket */
+    struct _gfxfontindex*index;
+    struct _gfxfontlist*hash_next;
 } gfxfontlist_t;
 
 void gfxdrawer_target_gfxline(gfxdrawer_t*d);
 
+/* A bump allocator. Memory is handed out from large chunks and only
+   given back in one go, by gfxarena_reset() or gfxarena_destroy(). */
+typedef struct _gfxarena gfxarena_t;
+gfxarena_t* gfxarena_new();
+void* gfxarena_alloc(gfxarena_t*arena, int size);
+void gfxarena_reset(gfxarena_t*arena);
+void gfxarena_destroy(gfxarena_t*arena);
+
+/* A packed path: one entry per segment, with the coordinates stored in
+   separate arrays. All memory comes from the arena. sx/sy are only
+   meaningful for splines. */
+typedef struct _gfxpath
+{
+    int num;
+    int size;
+    unsigned char*type; /* gfx_linetype */
+    gfxcoord_t*x,*y;
+    gfxcoord_t*sx,*sy;
+    gfxarena_t*arena;
+} gfxpath_t;
+
+gfxpath_t* gfxpath_new(gfxarena_t*arena);
+void gfxpath_add(gfxpath_t*path, gfx_linetype type, gfxcoord_t x, gfxcoord_t y, gfxcoord_t sx, gfxcoord_t sy);
+gfxpath_t* gfxpath_from_gfxline(gfxarena_t*arena, gfxline_t*line);
+/* returns a gfxline stored in a single block, which gfxline_free() recognizes */
+gfxline_t* gfxline_from_gfxpath(gfxpath_t*path);
+/* same as gfxline_optimize() */
+void gfxpath_optimize(gfxpath_t*path);
+gfxbbox_t gfxpath_getbbox(gfxpath_t*path);
+void gfxpath_transform(gfxpath_t*path, gfxmatrix_t*matrix);
+
+/* the result() of this drawer is a gfxpath_t* */
+void gfxdrawer_target_gfxpath(gfxdrawer_t*d, gfxarena_t*arena);
+
 void gfxtool_draw_dashed_line(gfxdrawer_t*d, gfxline_t*line, float*dashes, float phase);
 gfxline_t* gfxtool_dash_line(gfxline_t*line, float*dashes, float phase);
 
@@ -502,6 +502,118 @@ void kdtree_destroy(kdtree_t*tree)
     free(tree);
 }
 
+/* ---------------------------- static box tree ---------------------------- */
+
+#define KDBOX_LEAF_SIZE 8
+
+static int compare_entries_x(const void*_a, const void*_b)
+{
+    const kdboxentry_t*a = (const kdboxentry_t*)_a;
+    const kdboxentry_t*b = (const kdboxentry_t*)_b;
+    int64_t ca = (int64_t)a->bbox.xmin + a->bbox.xmax;
+    int64_t cb = (int64_t)b->bbox.xmin + b->bbox.xmax;
+    return (ca > cb) - (ca < cb);
+}
+static int compare_entries_y(const void*_a, const void*_b)
+{
+    const kdboxentry_t*a = (const kdboxentry_t*)_a;
+    const kdboxentry_t*b = (const kdboxentry_t*)_b;
+    int64_t ca = (int64_t)a->bbox.ymin + a->bbox.ymax;
+    int64_t cb = (int64_t)b->bbox.ymin + b->bbox.ymax;
+    return (ca > cb) - (ca < cb);
+}
+
+static kdboxnode_t* kdboxnode_build(kdboxentry_t*entries, int num)
+{
+    NEW(kdboxnode_t,node);
+    int t;
+    node->bbox = entries[0].bbox;
+    for(t=1;t<num;t++) {
+        kdbbox_t*b = &entries[t].bbox;
+        node->bbox.xmin = min32(node->bbox.xmin, b->xmin);
+        node->bbox.ymin = min32(node->bbox.ymin, b->ymin);
+        node->bbox.xmax = max32(node->bbox.xmax, b->xmax);
+        node->bbox.ymax = max32(node->bbox.ymax, b->ymax);
+    }
+    if(num <= KDBOX_LEAF_SIZE) {
+        node->entries = entries;
+        node->num_entries = num;
+        return node;
+    }
+    /* split along the longer side, at the median box center */
+    if((int64_t)node->bbox.xmax - node->bbox.xmin >= (int64_t)node->bbox.ymax - node->bbox.ymin) {
+        qsort(entries, num, sizeof(kdboxentry_t), compare_entries_x);
+    } else {
+        qsort(entries, num, sizeof(kdboxentry_t), compare_entries_y);
+    }
+    node->side[0] = kdboxnode_build(entries, num/2);
+    node->side[1] = kdboxnode_build(entries+num/2, num-num/2);
+    return node;
+}
+
+kdboxtree_t* kdboxtree_new(kdboxentry_t*entries, int num)
+{
+    NEW(kdboxtree_t,tree);
+    if(num) {
+        tree->entries = (kdboxentry_t*)malloc(sizeof(kdboxentry_t)*num);
+        memcpy(tree->entries, entries, sizeof(kdboxentry_t)*num);
+        tree->root = kdboxnode_build(tree->entries, num);
+    }
+    return tree;
+}
+
+static inline char kdbbox_intersects(const kdbbox_t*b, int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+{
+    return b->xmin <= x2 && b->xmax >= x1 && b->ymin <= y2 && b->ymax >= y1;
+}
+
+static kdresult_list_t* kdboxnode_find(kdboxnode_t*node, int32_t x1, int32_t y1, int32_t x2, int32_t y2, kdresult_list_t*list)
+{
+    if(!kdbbox_intersects(&node->bbox, x1, y1, x2, y2))
+        return list;
+    if(node->entries) {
+        int t;
+        for(t=0;t<node->num_entries;t++) {
+            if(kdbbox_intersects(&node->entries[t].bbox, x1, y1, x2, y2)) {
+                NEW(kdresult_list_t,r);
+                r->data = node->entries[t].data;
+                r->next = list;
+                list = r;
+            }
+        }
+        return list;
+    }
+    list = kdboxnode_find(node->side[0], x1, y1, x2, y2, list);
+    list = kdboxnode_find(node->side[1], x1, y1, x2, y2, list);
+    return list;
+}
+
+/* return the data of all boxes which intersect the given bounding box */
+kdresult_list_t*kdboxtree_find_in_box(kdboxtree_t*tree, int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+{
+    if(!tree->root)
+        return 0;
+    return kdboxnode_find(tree->root, x1, y1, x2, y2, 0);
+}
+
+static void kdboxnode_destroy(kdboxnode_t*node)
+{
+    if(node->side[0])
+        kdboxnode_destroy(node->side[0]);
+    if(node->side[1])
+        kdboxnode_destroy(node->side[1]);
+    free(node);
+}
+
+void kdboxtree_destroy(kdboxtree_t*tree)
+{
+    if(tree->root)
+        kdboxnode_destroy(tree->root);
+    if(tree->entries)
+        free(tree->entries);
+    free(tree);
+}
+
 #ifdef MAIN
 int main()
 {
@@ -91,6 +91,30 @@ kdresult_list_t*kdtree_find_in_box(kdtree_t*tree, int32_t x1, int32_t y1, int32_
 
 void kdtree_print(kdtree_t*tree);
 
+/* A static tree of (possibly overlapping) boxes, built in one go and
+   balanced by box centers. Unlike kdtree_t, queries don't modify the
+   tree, and building it takes O(n log^2 n). */
+typedef struct _kdboxentry {
+    kdbbox_t bbox;
+    void*data;
+} kdboxentry_t;
+
+typedef struct _kdboxnode {
+    kdbbox_t bbox; // of all boxes below this node
+    struct _kdboxnode*side[2];
+    kdboxentry_t*entries; // leafs only
+    int num_entries;
+} kdboxnode_t;
+
+typedef struct _kdboxtree {
+    kdboxnode_t*root;
+    kdboxentry_t*entries;
+} kdboxtree_t;
+
+kdboxtree_t* kdboxtree_new(kdboxentry_t*entries, int num);
+kdresult_list_t*kdboxtree_find_in_box(kdboxtree_t*tree, int32_t x1, int32_t y1, int32_t x2, int32_t y2);
+void kdboxtree_destroy(kdboxtree_t*tree);
+
 kdarea_t*kdarea_neighbor(kdarea_t*area, int dir, int xy);
 
 #define kdarea_left_neighbor(area, y) (kdarea_neighbor((area), KD_LEFT, (y)))
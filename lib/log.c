@@ -34,8 +34,23 @@
 #include <unistd.h>
 #endif
 
+#include "../config.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #include "log.h"
 
+#ifdef HAVE_PTHREADS
+/* messages may be logged from several rendering threads (gfx2gfx -j) */
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define lockLog() pthread_mutex_lock(&log_mutex)
+#define unlockLog() pthread_mutex_unlock(&log_mutex)
+#else
+#define lockLog()
+#define unlockLog()
+#endif
+
 int maxloglevel = 1;
 static int screenloglevel = 1;
 static int fileloglevel = -1;
@@ -106,6 +121,7 @@ static inline void log_str(const char* logString)
    int l;
 
    logBuffer = (char*)malloc (strlen(logString) + 24 + 15);
+   lockLog();
 #ifndef __NT__
    {
      /*time_t t = time(0);
@@ -177,6 +193,7 @@ static inline void log_str(const char* logString)
 	  fflush(logFile);
        }
    }
+   unlockLog();
 
    free (logBuffer);
 }
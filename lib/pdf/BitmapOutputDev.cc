@@ -28,12 +28,14 @@
   #include "splash/SplashBitmap.h"
   #include "splash/SplashPattern.h"
   #include "splash/Splash.h"
+  #include "splash/SplashClip.h"
 #else
   #include "xpdf/config.h"
   #include "SplashBitmap.h"
   #include "SplashGlyphBitmap.h"
   #include "SplashPattern.h"
   #include "Splash.h"
+  #include "SplashClip.h"
 #endif
 
 #include "../log.h"
@@ -55,6 +57,23 @@ ClipState::ClipState()
     this->written = 0;
 }
 
+DirtyArea::DirtyArea()
+{
+    reset();
+}
+void DirtyArea::reset()
+{
+    x1 = y1 = INT_MAX;
+    x2 = y2 = INT_MIN;
+}
+void DirtyArea::add(int _x1, int _y1, int _x2, int _y2)
+{
+    if(_x1 < x1) x1 = _x1;
+    if(_y1 < y1) y1 = _y1;
+    if(_x2 > x2) x2 = _x2;
+    if(_y2 > y2) y2 = _y2;
+}
+
 static gfxdevice_t* device_new_record()
 {
     gfxdevice_t*dev = (gfxdevice_t*)malloc(sizeof(gfxdevice_t));
@@ -102,6 +121,7 @@ BitmapOutputDev::BitmapOutputDev(InfoOutputDev*info, PDFDoc*doc, int*page2page,
     this->config_optimizeplaincolorfills = 0;
     this->config_skewedtobitmap = 0;
     this->config_alphatobitmap = 0;
+    this->softmask_active = gFalse;
     this->bboxpath = 0;
     //this->clipdev = 0;
     //this->clipstates = 0;
@@ -485,7 +505,22 @@ static inline GBool fixBBox(int*x1, int*y1, int*x2, int*y2, int width, int heigh
     return gTrue;
 }
 
-static void update_bitmap(SplashBitmap*bitmap, SplashBitmap*update, int x1, int y1, int x2, int y2, char overwrite)
+/* intersect a bounding box (as passed to checkNewText/checkNewBitmap) with the
+   dirty area. Returns gFalse if there's nothing left to look at. */
+GBool DirtyArea::clip(int*_x1, int*_y1, int*_x2, int*_y2, int width, int height)
+{
+    if(x1 >= x2 || y1 >= y2)
+	return gFalse;
+    if(!fixBBox(_x1, _y1, _x2, _y2, width, height))
+	return gFalse;
+    if(*_x1 < x1) *_x1 = x1;
+    if(*_y1 < y1) *_y1 = y1;
+    if(*_x2 > x2) *_x2 = x2;
+    if(*_y2 > y2) *_y2 = y2;
+    return *_x1 < *_x2 && *_y1 < *_y2;
+}
+
+static void update_bitmap(SplashBitmap*bitmap, DirtyArea*area, SplashBitmap*update, int x1, int y1, int x2, int y2, char overwrite)
 {
     assert(bitmap->getMode()==splashModeMono1);
     assert(update->getMode()==splashModeMono1);
@@ -498,6 +533,9 @@ static void update_bitmap(SplashBitmap*bitmap, SplashBitmap*update, int x1, int
 
     if(!fixBBox(&x1, &y1, &x2, &y2, bitmap->getWidth(), bitmap->getHeight()))
 	return;
+
+    /* we copy whole bytes */
+    area->add(x1&~7, y1, (x2+7)&~7, y2);
     
     Guchar*b = bitmap->getDataPtr() + y1*width8 + x1/8;
     Guchar*u = update->getDataPtr() + y1*width8 + x1/8;
@@ -650,12 +688,14 @@ GBool BitmapOutputDev::checkNewText(int x1, int y1, int x2, int y2)
     msg("<trace> Testing new text data against current bitmap data, state=%s, counter=%d\n", STATE_NAME[layerstate], dbg_btm_counter);
     
     GBool ret = false;
-    if(intersection(booltextbitmap, stalepolybitmap, x1,y1,x2,y2)) {
+    int ix1=x1, iy1=y1, ix2=x2, iy2=y2;
+    if(stalepolyarea.clip(&ix1, &iy1, &ix2, &iy2, stalepolybitmap->getWidth(), stalepolybitmap->getHeight()) &&
+       intersection(booltextbitmap, stalepolybitmap, ix1,iy1,ix2,iy2)) {
 	if(layerstate==STATE_PARALLEL) {
 	    /* the new text is above the bitmap. So record that fact. */
 	    msg("<verbose> Text is above current bitmap/polygon data");
 	    layerstate=STATE_TEXT_IS_ABOVE;
-	    update_bitmap(staletextbitmap, booltextbitmap, x1, y1, x2, y2, 0);
+	    update_bitmap(staletextbitmap, &staletextarea, booltextbitmap, x1, y1, x2, y2, 0);
 	} else if(layerstate==STATE_BITMAP_IS_ABOVE) {
 	    /* there's a bitmap above the (old) text. So we need
 	       to flush out that text, and record that the *new*
@@ -668,7 +708,7 @@ GBool BitmapOutputDev::checkNewText(int x1, int y1, int x2, int y2)
 	   
 	    clearBoolTextDev();
 	    /* re-apply the update (which we would otherwise lose) */
-	    update_bitmap(staletextbitmap, booltextbitmap, x1, y1, x2, y2, 1);
+	    update_bitmap(staletextbitmap, &staletextarea, booltextbitmap, x1, y1, x2, y2, 1);
             ret = true;
 	} else {
 	    /* we already know that the current text section is
@@ -676,11 +716,11 @@ GBool BitmapOutputDev::checkNewText(int x1, int y1, int x2, int y2)
 	       bitmap data *and* new text data was drawn, and
 	       *again* it's above the current bitmap. */
 	    msg("<verbose> Text is still above current bitmap/polygon data");
-	    update_bitmap(staletextbitmap, booltextbitmap, x1, y1, x2, y2, 0);
+	    update_bitmap(staletextbitmap, &staletextarea, booltextbitmap, x1, y1, x2, y2, 0);
 	}
     }  else {
         msg("<verbose> no intersection");
-	update_bitmap(staletextbitmap, booltextbitmap, x1, y1, x2, y2, 0);
+	update_bitmap(staletextbitmap, &staletextarea, booltextbitmap, x1, y1, x2, y2, 0);
     }
     
     /* clear the thing we just drew from our temporary drawing bitmap */
@@ -701,25 +741,27 @@ GBool BitmapOutputDev::checkNewBitmap(int x1, int y1, int x2, int y2)
     msg("<trace> Testing new graphics data against current text data, state=%s, counter=%d\n", STATE_NAME[layerstate], dbg_btm_counter);
 
     GBool ret = false;
-    if(intersection(boolpolybitmap, staletextbitmap, x1,y1,x2,y2)) {
+    int ix1=x1, iy1=y1, ix2=x2, iy2=y2;
+    if(staletextarea.clip(&ix1, &iy1, &ix2, &iy2, staletextbitmap->getWidth(), staletextbitmap->getHeight()) &&
+       intersection(boolpolybitmap, staletextbitmap, ix1,iy1,ix2,iy2)) {
 	if(layerstate==STATE_PARALLEL) {
 	    msg("<verbose> Bitmap is above current text data");
 	    layerstate=STATE_BITMAP_IS_ABOVE;
-	    update_bitmap(stalepolybitmap, boolpolybitmap, x1, y1, x2, y2, 0);
+	    update_bitmap(stalepolybitmap, &stalepolyarea, boolpolybitmap, x1, y1, x2, y2, 0);
 	} else if(layerstate==STATE_TEXT_IS_ABOVE) {
 	    msg("<verbose> Bitmap is above current text data (which is above some bitmap)");
 	    flushBitmap();
 	    layerstate=STATE_BITMAP_IS_ABOVE;
 	    clearBoolPolyDev();
-	    update_bitmap(stalepolybitmap, boolpolybitmap, x1, y1, x2, y2, 1);
+	    update_bitmap(stalepolybitmap, &stalepolyarea, boolpolybitmap, x1, y1, x2, y2, 1);
             ret = true;
 	} else {
 	    msg("<verbose> Bitmap is still above current text data");
-	    update_bitmap(stalepolybitmap, boolpolybitmap, x1, y1, x2, y2, 0);
+	    update_bitmap(stalepolybitmap, &stalepolyarea, boolpolybitmap, x1, y1, x2, y2, 0);
 	}
     }  else {
         msg("<verbose> no intersection");
-	update_bitmap(stalepolybitmap, boolpolybitmap, x1, y1, x2, y2, 0);
+	update_bitmap(stalepolybitmap, &stalepolyarea, boolpolybitmap, x1, y1, x2, y2, 0);
     }
     
     /* clear the thing we just drew from our temporary drawing bitmap */
@@ -1026,6 +1068,10 @@ void BitmapOutputDev::beginPage(GfxState *state, int pageNum)
 
     msg("<debug> startPage %dx%d (%dx%d)", this->width, this->height, booltextbitmap->getWidth(), booltextbitmap->getHeight());
 
+    /* new bitmaps aren't initialized, so they need to be cleared as a whole */
+    stalepolyarea.add(0, 0, stalepolybitmap->getWidth(), stalepolybitmap->getHeight());
+    staletextarea.add(0, 0, staletextbitmap->getWidth(), staletextbitmap->getHeight());
+
     clip0bitmap = clip0dev->getBitmap();
     clip1bitmap = clip1dev->getBitmap();
     rgbbitmap = rgbdev->getBitmap();
@@ -1048,6 +1094,7 @@ void BitmapOutputDev::beginPage(GfxState *state, int pageNum)
 
     this->layerstate = STATE_PARALLEL;
     this->emptypage = 1;
+    this->softmask_active = gFalse;
     msg("<debug> startPage done");
 }
 
@@ -1163,6 +1210,10 @@ void BitmapOutputDev::restoreState(GfxState *state)
     clip0dev->restoreState(state);
     clip1dev->restoreState(state);
 
+    /* splash keeps the soft mask in its graphic state, so a Q may
+       have brought back a mask, or removed one */
+    this->softmask_active = rgbdev->getSplash()->getSoftMask() != 0;
+
     /*if(this->clipstates) {
 	ClipState*old = this->clipstates;
 	if(old->written) {
@@ -1621,11 +1672,15 @@ void BitmapOutputDev::clearClips(int x1, int y1, int x2, int y2)
 }
 void BitmapOutputDev::clearBoolPolyDev()
 {
-    clearBooleanBitmap(stalepolybitmap, 0, 0, stalepolybitmap->getWidth(), stalepolybitmap->getHeight());
+    if(stalepolyarea.x1 < stalepolyarea.x2 && stalepolyarea.y1 < stalepolyarea.y2)
+	clearBooleanBitmap(stalepolybitmap, stalepolyarea.x1, stalepolyarea.y1, stalepolyarea.x2, stalepolyarea.y2);
+    stalepolyarea.reset();
 }
 void BitmapOutputDev::clearBoolTextDev()
 {
-    clearBooleanBitmap(staletextbitmap, 0, 0, staletextbitmap->getWidth(), staletextbitmap->getHeight());
+    if(staletextarea.x1 < staletextarea.x2 && staletextarea.y1 < staletextarea.y2)
+	clearBooleanBitmap(staletextbitmap, staletextarea.x1, staletextarea.y1, staletextarea.x2, staletextarea.y2);
+    staletextarea.reset();
 }
 
 #define USE_GETGLYPH_BBOX
@@ -1740,11 +1795,6 @@ void BitmapOutputDev::drawChar(GfxState *state, double x, double y,
 	if(x2 > text_x2) text_x2 = x2;
 	if(y2 > text_y2) text_y2 = y2;
 
-	/* only clear the area we're going to check */
-	clearClips(x1,y1,x2,y2);
-	clip0dev->drawChar(state, x, y, dx, dy, originX, originY, code, nBytes, u, uLen);
-	clip1dev->drawChar(state, x, y, dx, dy, originX, originY, code, nBytes, u, uLen);
-
         int page_area_x1 = -this->movex;
         int page_area_y1 = -this->movey;
         int page_area_x2 = this->width-this->movex;
@@ -1757,10 +1807,25 @@ void BitmapOutputDev::drawChar(GfxState *state, double x, double y,
 	/* if this character is affected somehow by the various clippings (i.e., it looks
 	   different on a device without clipping), then draw it on the bitmap, not as
 	   text */
-	if(char_is_outside || render_as_bitmap || clip0and1differ(x1,y1,x2,y2)) {
+	char char_is_clipped = 0;
+	if(!char_is_outside && !render_as_bitmap && softmask_active) {
+	    /* The clip devices are monochrome, and splash ignores soft masks in mono
+	       mode, so comparing them wouldn't tell us anything. Soft masked chars
+	       always go to the bitmap. */
+	    char_is_clipped = 1;
+	} else if(!char_is_outside && !render_as_bitmap &&
+	   clip1dev->getSplash()->getClip()->testRect(x1, y1, x2-1, y2-1) != splashClipAllInside) {
+	    /* Only if the char isn't entirely inside a rectangular clipping region,
+	       we actually need to render it twice to find out. */
+	    clearClips(x1,y1,x2,y2);
+	    clip0dev->drawChar(state, x, y, dx, dy, originX, originY, code, nBytes, u, uLen);
+	    clip1dev->drawChar(state, x, y, dx, dy, originX, originY, code, nBytes, u, uLen);
+	    char_is_clipped = clip0and1differ(x1,y1,x2,y2);
+	}
+	if(char_is_outside || render_as_bitmap || char_is_clipped) {
             if(char_is_outside) msg("<verbose> Char %d is outside the page (%d,%d,%d,%d)", code, x1, y1, x2, y2);
             else if(render_as_bitmap)  msg("<verbose> Char %d needs to be rendered as bitmap", code);
-            else msg("<verbose> Char %d is affected by clipping", code);
+            else msg("<verbose> Char %d is affected by clipping or soft masking", code);
 
 	    boolpolydev->drawChar(state, x, y, dx, dy, originX, originY, code, nBytes, u, uLen);
 	    checkNewBitmap(x1,y1,x2,y2);
@@ -2072,6 +2137,7 @@ void BitmapOutputDev::setSoftMask(GfxState *state, double *bbox, GBool alpha, Fu
     checkNewBitmap(UNKNOWN_BOUNDING_BOX);
     rgbdev->setSoftMask(state, bbox, alpha, transferFunc, backdropColor);
     clip1dev->setSoftMask(state, bbox, alpha, transferFunc, backdropColor);
+    this->softmask_active = gTrue;
     dbg_newdata("setsoftmask");
 }
 void BitmapOutputDev::clearSoftMask(GfxState *state)
@@ -2081,5 +2147,6 @@ void BitmapOutputDev::clearSoftMask(GfxState *state)
     checkNewBitmap(UNKNOWN_BOUNDING_BOX);
     rgbdev->clearSoftMask(state);
     clip1dev->clearSoftMask(state);
+    this->softmask_active = gFalse;
     dbg_newdata("clearsoftmask");
 }
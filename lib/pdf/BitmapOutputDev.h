@@ -39,6 +39,17 @@ struct ClipState
     ClipState();
 };
 
+/* The part of a boolean bitmap in which pixels may be set. Everything
+   outside of it is known to be zero. */
+struct DirtyArea
+{
+    int x1,y1,x2,y2;
+    DirtyArea();
+    void reset();
+    void add(int x1, int y1, int x2, int y2);
+    GBool clip(int*x1, int*y1, int*x2, int*y2, int width, int height);
+};
+
 #define STATE_PARALLEL 0
 #define STATE_TEXT_IS_ABOVE 1
 #define STATE_BITMAP_IS_ABOVE 2
@@ -209,6 +220,7 @@ private:
 
     int layerstate;
     GBool emptypage;
+    GBool softmask_active;
 
     SplashPath*bboxpath;
 
@@ -225,6 +237,8 @@ private:
     SplashBitmap*stalepolybitmap;
     SplashBitmap*booltextbitmap;
     SplashBitmap*staletextbitmap;
+    DirtyArea stalepolyarea;
+    DirtyArea staletextarea;
 
     gfxdevice_t* gfxoutput;
     gfxdevice_t* gfxoutput_string;
@@ -146,6 +146,9 @@ public:
     }
 };
     
+#ifdef HAVE_POPPLER
+/* poppler can only load fonts from files, so the standard fonts
+   have to be written out to the temp directory first */
 char* writeOutStdFont(fontentry* f)
 {
     FILE*fi;
@@ -197,6 +200,7 @@ void unlinkfont(char* filename)
 	return;
     }
 }
+#endif
 
 static int config_use_fontconfig = 1;
 static int fcinitcalled = 0; 
@@ -205,16 +209,24 @@ GFXGlobalParams::GFXGlobalParams()
 : GlobalParams((char*)"")
 {
     //setupBaseFonts(char *dir); //not tested yet
+#ifdef HAVE_PTHREADS
+    pthread_mutex_init(&mutex, 0);
+#endif
 }
 GFXGlobalParams::~GFXGlobalParams()
 {
     msg("<verbose> Performing cleanups");
+#ifdef HAVE_PTHREADS
+    pthread_mutex_destroy(&mutex);
+#endif
+#ifdef HAVE_POPPLER
     int t;
     for(t=0;t<sizeof(pdf2t1map)/sizeof(fontentry);t++) {
 	if(pdf2t1map[t].fullfilename) {
 	    unlinkfont(pdf2t1map[t].fullfilename);
 	}
     }
+#endif
 #ifdef HAVE_FONTCONFIG
     if(config_use_fontconfig && fcinitcalled)
 	FcFini();
@@ -433,6 +445,18 @@ static DisplayFontParamKind detectFontType(const char*filename)
 }
 
 DisplayFontParam *GFXGlobalParams::getDisplayFont(GString *fontName)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&mutex);
+#endif
+    DisplayFontParam*dfp = findDisplayFont(fontName);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&mutex);
+#endif
+    return dfp;
+}
+
+DisplayFontParam *GFXGlobalParams::findDisplayFont(GString *fontName)
 {
     msg("<verbose> looking for font %s", fontName->getCString());
 
@@ -442,7 +466,8 @@ DisplayFontParam *GFXGlobalParams::getDisplayFont(GString *fontName)
     int t;
     for(t=0;t<sizeof(pdf2t1map)/sizeof(fontentry);t++) {
 	if(!strcmp(name, pdf2t1map[t].pdffont)) {
-	    if(!pdf2t1map[t].fullfilename) {
+	    if(!pdf2t1map[t].dfp) {
+#ifdef HAVE_POPPLER
 		pdf2t1map[t].fullfilename = writeOutStdFont(&pdf2t1map[t]);
 		if(!pdf2t1map[t].fullfilename) {
 		    msg("<error> Couldn't save default font- is the Temp Directory writable?");
@@ -451,6 +476,15 @@ DisplayFontParam *GFXGlobalParams::getDisplayFont(GString *fontName)
 		}
 		DisplayFontParam *dfp = new DisplayFontParam(new GString(fontName), displayFontT1);
 		dfp->t1.fileName = new GString(pdf2t1map[t].fullfilename);
+#else
+		/* the font program is handed to FreeType directly from fonts.c */
+		msg("<verbose> Using built-in standard PDF font %s (%s)", name, pdf2t1map[t].filename);
+		DisplayFontParam *dfp = new DisplayFontParam(new GString(fontName), displayFontT1);
+		dfp->t1.fileName = new GString(pdf2t1map[t].filename);
+		dfp->t1.fileName->append(".pfb");
+		dfp->t1.buf = pdf2t1map[t].pfb;
+		dfp->t1.bufLen = pdf2t1map[t].pfblen;
+#endif
 		pdf2t1map[t].dfp = dfp;
 	    }
 	    return pdf2t1map[t].dfp;
@@ -513,6 +547,10 @@ CharOutputDev::CharOutputDev(InfoOutputDev*info, PDFDoc*doc, int*page2page, int
 :CommonOutputDev(info, doc, page2page, num_pages, x, y, x1, y1, x2, y2)
 {
     this->type3active = 0;
+    this->needs_outlines = gTrue;
+    this->cached_fontinfo = 0;
+    this->cached_gfxfont = 0;
+    this->cached_font = 0;
     this->xref = 0;
     this->current_text_stroke = 0;
     this->current_text_clip = 0;
@@ -671,6 +709,11 @@ GBool CharOutputDev::needNonText()
     return gFalse; 
 }
 
+GBool CharOutputDev::needOnlyText() 
+{ 
+    return gTrue; 
+}
+
 void CharOutputDev::endPage() 
 {
     msg("<verbose> endPage (GfxOutputDev)");
@@ -738,6 +781,54 @@ char* makeStringPrintable(char*str)
 
 void CharOutputDev::updateTextMat(GfxState*state)
 {
+    this->cached_fontinfo = 0;
+}
+
+/* Consecutive characters of a text run almost always share their font class.
+   Instead of building the class (font id, transform, color) for every char, 
+   remember the state values it is derived from, and only go through
+   InfoOutputDev::getFontInfo() if one of them changed. */
+FontInfo* CharOutputDev::lookupFontInfo(GfxState*state)
+{
+    double key[12];
+    double*ctm = state->getCTM();
+    double*tm = state->getTextMat();
+    key[0] = ctm[0]; key[1] = ctm[1]; key[2] = ctm[2]; key[3] = ctm[3];
+    key[4] = tm[0]; key[5] = tm[1]; key[6] = tm[2]; key[7] = tm[3];
+    key[8] = state->getFontSize();
+    key[9] = state->getHorizScaling();
+    key[10] = state->getRender();
+    key[11] = state->getFillOpacity();
+
+    if(cached_fontinfo && cached_font == state->getFont() &&
+       !memcmp(key, cached_fontkey, sizeof(key))) {
+	return cached_fontinfo;
+    }
+    cached_fontinfo = this->info->getFontInfo(state);
+    cached_gfxfont = 0;
+    cached_font = state->getFont();
+    memcpy(cached_fontkey, key, sizeof(key));
+    return cached_fontinfo;
+}
+
+/* Font infos are shared between all pages (and threads), so everything
+   which might modify them happens while holding the InfoOutputDev's lock */
+gfxfont_t* CharOutputDev::getGfxFont(GfxState*state, FontInfo*fontinfo)
+{
+    this->info->lock();
+    if(needs_outlines && fontinfo->outlines_missing) {
+	this->info->loadGlyphOutlines(state, fontinfo);
+    }
+    gfxfont_t*font = fontinfo->getGfxFont();
+    char seen = fontinfo->seen;
+    fontinfo->seen = 1;
+    this->info->unlock();
+
+    if(!seen) {
+	dumpFontInfo("<verbose>", state->getFont());
+	device->addfont(device, font);
+    }
+    return font;
 }
 
 void CharOutputDev::beginString(GfxState *state, GString *s) 
@@ -761,18 +852,16 @@ void CharOutputDev::drawChar(GfxState *state, double x, double y,
 			double originX, double originY,
 			CharCode charid, int nBytes, Unicode *_u, int uLen)
 {
-    FontInfo*current_fontinfo = this->info->getFontInfo(state);
+    FontInfo*current_fontinfo = lookupFontInfo(state);
 
     if(!current_fontinfo || (unsigned)charid >= current_fontinfo->num_glyphs || !current_fontinfo->glyphs[charid]) {
 	msg("<error> Invalid charid %d for font %p (%d characters)", charid, current_fontinfo, current_fontinfo?current_fontinfo->num_glyphs:0);
 	return;
     }
 
-    gfxfont_t*current_gfxfont = current_fontinfo->getGfxFont();
-    if(!current_fontinfo->seen) {
-	dumpFontInfo("<verbose>", state->getFont());
-	device->addfont(device, current_gfxfont);
-        current_fontinfo->seen = 1;
+    gfxfont_t*current_gfxfont = cached_gfxfont;
+    if(!current_gfxfont) {
+	current_gfxfont = cached_gfxfont = getGfxFont(state, current_fontinfo);
     }
 
     CharCode glyphid = current_fontinfo->glyphs[charid]->glyphid;
@@ -928,7 +1017,9 @@ GBool CharOutputDev::beginType3Char(GfxState *state, double x, double y, double
 	    msg("<error> Couldn't find font info");
 	    return gFalse;
 	}
+	info->lock();
 	gfxfont_t*current_gfxfont = current_fontinfo->getGfxFont();
+	info->unlock();
 
 	/*m.m00*=INTERNAL_FONT_SIZE;
 	m.m01*=INTERNAL_FONT_SIZE;
@@ -965,6 +1056,7 @@ void CharOutputDev::endType3Char(GfxState *state)
 void CharOutputDev::beginPage(GfxState *state, int pageNum)
 {
     this->currentpage = pageNum;
+    this->cached_fontinfo = 0;
     this->last_char_was_space = 1;
     this->last_char_y = 0;
     this->last_char_y_fontsize = 0;
@@ -1224,6 +1316,8 @@ void CharOutputDev::restoreState(GfxState *state)
  
 void CharOutputDev::updateFont(GfxState *state) 
 {
+    this->cached_fontinfo = 0;
+
     GfxFont* gfxFont = state->getFont();
     if (!gfxFont) {
 	return; 
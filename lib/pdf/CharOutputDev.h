@@ -58,11 +58,26 @@ public:
   virtual void type3D1(GfxState *state, double wx, double wy, double llx, double lly, double urx, double ury);
 
   virtual GBool needNonText();
+  virtual GBool needOnlyText();
+
+  // whether the device we draw to needs glyph outlines (as opposed to
+  // only unicode and advance information)
+  void setNeedsOutlines(GBool needs) {this->needs_outlines = needs;}
 
   private:
+
+  FontInfo* lookupFontInfo(GfxState*state);
+  gfxfont_t* getGfxFont(GfxState*state, FontInfo*fontinfo);
   
   int currentpage;
   int type3active; // are we between beginType3()/endType3()?
+  GBool needs_outlines;
+
+  // the font info of the last drawChar(), and the state it was looked up for
+  FontInfo*cached_fontinfo;
+  gfxfont_t*cached_gfxfont;
+  GfxFont*cached_font;
+  double cached_fontkey[12];
 
   gfxline_t* current_text_stroke;
   gfxline_t* current_text_clip;
@@ -114,6 +129,11 @@ class GFXGlobalParams:  public GlobalParams {
     ~GFXGlobalParams();
     virtual DisplayFontParam *getDisplayFont(GString *fontName);
     virtual DisplayFontParam *getDisplayCIDFont(GString *fontName, GString *collection);
+    private:
+    DisplayFontParam *findDisplayFont(GString *fontName);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t mutex; // the standard fonts are written out on first use
+#endif
 };
 
 #endif //__charoutputdev_h__
@@ -69,6 +69,9 @@ GFXOutputGlobals::GFXOutputGlobals()
     this->textmodeinfo = 0;
     this->linkinfo = 0;
     this->pbminfo = 0;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_init(&this->mutex, 0);
+#endif
 }
 GFXOutputGlobals::~GFXOutputGlobals()
 {
@@ -83,25 +86,43 @@ GFXOutputGlobals::~GFXOutputGlobals()
 	f = next;
     }
     this->featurewarnings = 0;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_destroy(&this->mutex);
+#endif
 }
 
 static GFXOutputGlobals*gfxglobals=0;
 
-static void showfeature(const char*feature, char fully, char warn)
+static char addfeature(const char*feature)
 {
-    if(!gfxglobals)
-	gfxglobals = new GFXOutputGlobals();
-
     feature_t*f = gfxglobals->featurewarnings;
     while(f) {
 	if(!strcmp(feature, f->string))
-	    return;
+	    return 0;
 	f = f->next;
     }
     f = (feature_t*)malloc(sizeof(feature_t));
     f->string = strdup(feature);
     f->next = gfxglobals->featurewarnings;
     gfxglobals->featurewarnings = f;
+    return 1;
+}
+
+static void showfeature(const char*feature, char fully, char warn)
+{
+    if(!gfxglobals)
+	gfxglobals = new GFXOutputGlobals();
+
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&gfxglobals->mutex);
+#endif
+    char is_new = addfeature(feature);
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&gfxglobals->mutex);
+#endif
+    if(!is_new)
+	return;
+
     if(warn) {
 	msg("<warning> %s not yet %ssupported!",feature,fully?"fully ":"");
     } else {
@@ -39,6 +39,9 @@ typedef struct _feature
 class GFXOutputGlobals {
 public:
   feature_t*featurewarnings;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t mutex; // protects featurewarnings
+#endif
 
   int textmodeinfo; // did we write "Text will be rendered as polygon" yet?
   int jpeginfo; // did we write "File contains jpegs" yet?
@@ -22,6 +22,7 @@ int config_marker_glyph = 0;
 int config_normalize_fonts = 0;
 int config_remove_font_transforms = 0;
 int config_remove_invisible_outlines = 0;
+int config_glyph_outlines = 1;
 
 static void* fontclass_clone(const void*_m) {
     if(_m==0) 
@@ -100,6 +101,7 @@ InfoOutputDev::InfoOutputDev(XRef*xref)
     num_polygons= 0;
     num_layers = 0;
     num_text_breaks = 0;
+    only_text = 0;
     currentglyph = 0;
     previous_was_char = 0;
     SplashColor white = {255,255,255};
@@ -107,7 +109,13 @@ InfoOutputDev::InfoOutputDev(XRef*xref)
     splash->startDoc(xref);
     last_font = 0;
     current_type3_font = 0;
+    current_splash_font = 0;
     fontcache = dict_new2(&fontclass_type);
+    diskcache = 0;
+    current_cached_font = 0;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_init(&mutex, 0);
+#endif
 }
 InfoOutputDev::~InfoOutputDev() 
 {
@@ -117,8 +125,30 @@ InfoOutputDev::~InfoOutputDev()
 	delete fd;
     }
     dict_destroy(this->fontcache);this->fontcache=0;
+    if(this->diskcache) {
+	delete this->diskcache;this->diskcache=0;
+    }
 
     delete splash;splash=0;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_destroy(&mutex);
+#endif
+}
+void InfoOutputDev::lock()
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&mutex);
+#endif
+}
+void InfoOutputDev::unlock()
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+void InfoOutputDev::setFontCache(FontCache*cache)
+{
+    this->diskcache = cache;
 }
 
 void FontInfo::grow(int size)
@@ -142,9 +172,12 @@ FontInfo::FontInfo(fontclass_t*fontclass)
 
     this->fontclass = (fontclass_t*)fontclass_type.dup(fontclass);
     this->seen = 0;
+    this->outlines_missing = 0;
     this->num_glyphs = 0;
     this->glyphs = 0;
     this->gfxfont = 0;
+    this->retired_gfxfonts = 0;
+    this->generation = 0;
     this->space_char = -1;
     this->ascender = 0;
     this->descender = 0;
@@ -168,6 +201,8 @@ FontInfo::~FontInfo()
     free(glyphs);glyphs=0;
     if(this->gfxfont)
         gfxfont_free(this->gfxfont);
+    gfxfontlist_free(this->retired_gfxfonts, 1);
+    this->retired_gfxfonts = 0;
 
     if(this->fontclass) {
 	fontclass_type.free(this->fontclass);
@@ -289,6 +324,7 @@ gfxfont_t* FontInfo::createGfxFont()
     font->ascent = fabs(this->ascender);
     font->descent = fabs(this->descender);
 
+    gfxarena_t*arena = gfxarena_new();
     for(t=0;t<this->num_glyphs;t++) {
 	if(this->glyphs[t]) {
 	    SplashPath*path = this->glyphs[t]->path;
@@ -298,7 +334,7 @@ gfxfont_t* FontInfo::createGfxFont()
 	    this->glyphs[t]->glyphid = font->num_glyphs;
 	    glyph->unicode = this->glyphs[t]->unicode;
 	    gfxdrawer_t drawer;
-	    gfxdrawer_target_gfxline(&drawer);
+	    gfxdrawer_target_gfxpath(&drawer, arena);
 	    int s;
 	    int count = 0;
 	    double xmax = 0;
@@ -329,7 +365,8 @@ gfxfont_t* FontInfo::createGfxFont()
 	     //       			  (f&splashPathLast)?"last":"");
 	    }
 
-	    glyph->line = (gfxline_t*)drawer.result(&drawer);
+	    glyph->line = gfxline_from_gfxpath((gfxpath_t*)drawer.result(&drawer));
+	    gfxarena_reset(arena);
 	    if(this->glyphs[t]->advance>0) {
 		glyph->advance = this->glyphs[t]->advance;
 	    } else {
@@ -345,6 +382,7 @@ gfxfont_t* FontInfo::createGfxFont()
 	    font->num_glyphs++;
 	}
     }
+    gfxarena_destroy(arena);
   
     if(config_remove_font_transforms) {
 	gfxmatrix_t glyph_transform;
@@ -411,11 +449,32 @@ static float find_average_glyph_advance(gfxfont_t*f)
     return m;
 }
 
+void FontInfo::invalidateGfxFont()
+{
+    if(!this->gfxfont)
+	return;
+    /* the glyph table changed after the font was already passed to
+       a device. Keep the old font around (the device may still hold a
+       pointer to it), and generate a new one, under a new id, on the
+       next getGfxFont() */
+    msg("<debug> Font %s changed after it was used, regenerating", this->gfxfont->id);
+    this->retired_gfxfonts = gfxfontlist_addfont(this->retired_gfxfonts, this->gfxfont);
+    this->gfxfont = 0;
+    this->seen = 0;
+    this->generation++;
+}
+
 gfxfont_t* FontInfo::getGfxFont()
 {
     if(!this->gfxfont) {
         this->gfxfont = this->createGfxFont();
-        this->gfxfont->id = strdup(this->id);
+	if(!this->generation) {
+	    this->gfxfont->id = strdup(this->id);
+	} else {
+	    char*id = (char*)malloc(strlen(this->id)+16);
+	    sprintf(id, "%s.%d", this->id, this->generation);
+	    this->gfxfont->id = id;
+	}
 	this->space_char = findSpace(this->gfxfont);
 	this->average_advance = find_average_glyph_advance(this->gfxfont);
 
@@ -557,16 +616,16 @@ GBool InfoOutputDev::needNonText()
     return gFalse; 
 }
 
-void InfoOutputDev::updateFont(GfxState *state) 
+GBool InfoOutputDev::needOnlyText() 
+{ 
+    return only_text; 
+}
+
+SplashFont* InfoOutputDev::loadSplashFont(GfxState *state)
 {
     GfxFont*font = state->getFont();
-    if(!font) {
-	current_splash_font = 0;
-	return;
-    }
-    if(font->getType() == fontType3) {
-	current_splash_font = 0;
-	return;
+    if(!font || font->getType() == fontType3) {
+	return 0;
     }
     GfxState* state2 = state->copy();
     state2->setPath(0);
@@ -575,9 +634,85 @@ void InfoOutputDev::updateFont(GfxState *state)
     state2->setTextMat(1.0,0,0,1.0,0,0);
     state2->setFont(font, 1024.0);
     splash->doUpdateFont(state2);
-
-    current_splash_font = splash->getCurrentFont();
     delete state2;
+    return splash->getCurrentFont();
+}
+
+void InfoOutputDev::updateFont(GfxState *state) 
+{
+    current_cached_font = 0;
+    if(!config_glyph_outlines) {
+	/* metrics only- we don't need to load the font program */
+	current_splash_font = 0;
+	return;
+    }
+    if(diskcache && state->getFont()) {
+	current_cached_font = diskcache->getFont(state->getFont());
+	if(current_cached_font && current_cached_font->has_metrics) {
+	    /* the font program is only loaded once we come across
+	       a char which isn't in the cache */
+	    current_splash_font = 0;
+	    return;
+	}
+    }
+    current_splash_font = loadSplashFont(state);
+    if(current_cached_font && current_splash_font) {
+	current_cached_font->setMetrics(current_splash_font->ascender, current_splash_font->descender);
+    }
+}
+
+/* Used if fonts were collected without glyph outlines (glyphoutlines=0),
+   but are now passed to a device which needs them. Has to be called while
+   the font is active in the given state. */
+void InfoOutputDev::loadGlyphOutlines(GfxState*state, FontInfo*fontinfo)
+{
+    if(!fontinfo->outlines_missing)
+	return;
+    fontinfo->outlines_missing = 0;
+
+    SplashFont*splash_font = loadSplashFont(state);
+    if(!splash_font) {
+	msg("<warning> Couldn't load glyph outlines for font %s", fontinfo->fontclass->id);
+	return;
+    }
+    msg("<verbose> Loading glyph outlines for font %s", fontinfo->fontclass->id);
+    int t;
+    for(t=0;t<fontinfo->num_glyphs;t++) {
+	GlyphInfo*g = fontinfo->glyphs[t];
+	if(g && !g->path) {
+	    g->path = splash_font->getGlyphPath(t);
+	}
+    }
+    fontinfo->invalidateGfxFont();
+}
+
+/* the advance of a char, in glyph space, derived from the PDF's width
+   tables instead of the font program */
+static double glyph_advance(GfxState*state, CharCode code, int nBytes, double dx, double dy)
+{
+    GfxFont*font = state->getFont();
+    if(!font->isCIDFont()) {
+	return ((Gfx8BitFont*)font)->getWidth(code&0xff) * INTERNAL_FONT_SIZE;
+    }
+    /* CID fonts don't expose their width table, so undo the transformations
+       Gfx::doShowText applied to the displacement */
+    double*tm = state->getTextMat();
+    double w;
+    if(fabs(tm[0]) > fabs(tm[1])) {
+	w = dx / tm[0];
+    } else if(tm[1]) {
+	w = dy / tm[1];
+    } else {
+	return 0;
+    }
+    if(state->getHorizScaling())
+	w /= state->getHorizScaling();
+    w -= state->getCharSpace();
+    if(nBytes == 1 && code == 32)
+	w -= state->getWordSpace();
+    if(!state->getFontSize())
+	return 0;
+    return w / state->getFontSize() * INTERNAL_FONT_SIZE;
 }
 
 double matrix_scale_factor(gfxmatrix_t*m)
@@ -695,6 +830,12 @@ FontInfo* InfoOutputDev::getOrCreateFontInfo(GfxState*state)
 	if(current_splash_font) {
 	    fontinfo->ascender = current_splash_font->ascender;
 	    fontinfo->descender = current_splash_font->descender;
+	} else if(current_cached_font && current_cached_font->has_metrics) {
+	    fontinfo->ascender = current_cached_font->ascender;
+	    fontinfo->descender = current_cached_font->descender;
+	} else if(!config_glyph_outlines && font->getType() != fontType3) {
+	    fontinfo->ascender = font->getAscent() * INTERNAL_FONT_SIZE;
+	    fontinfo->descender = font->getDescent() * INTERNAL_FONT_SIZE;
 	} else {
 	    fontinfo->ascender = fontinfo->descender = 0;
 	}
@@ -754,7 +895,7 @@ void InfoOutputDev::drawChar(GfxState *state, double x, double y,
 	msg("<error> Internal error: No fontinfo for font");
 	return; //error
     }
-    if(!current_splash_font) {
+    if(!current_splash_font && !current_cached_font && config_glyph_outlines) {
 	msg("<error> Internal error: No current splash fontinfo");
 	return; //error
     }
@@ -778,13 +919,34 @@ void InfoOutputDev::drawChar(GfxState *state, double x, double y,
     if(!g) {
 	g = fontinfo->glyphs[code] = new GlyphInfo();
 	g->advance_max = 0;
-	current_splash_font->last_advance = -1;
-	g->path = current_splash_font->getGlyphPath(code);
-	g->advance = current_splash_font->last_advance;
+	if(config_glyph_outlines) {
+	    if(!current_cached_font || !current_cached_font->getGlyph(code, &g->path, &g->advance)) {
+		if(!current_splash_font) {
+		    current_splash_font = loadSplashFont(state);
+		}
+		if(current_splash_font) {
+		    current_splash_font->last_advance = -1;
+		    g->path = current_splash_font->getGlyphPath(code);
+		    g->advance = current_splash_font->last_advance;
+		    if(current_cached_font)
+			current_cached_font->addGlyph(code, g->path, g->advance);
+		} else {
+		    msg("<error> Couldn't load font for glyph %d", code);
+		    g->path = 0;
+		    g->advance = 0;
+		}
+	    }
+	} else {
+	    g->path = 0;
+	    g->advance = glyph_advance(state, code, nBytes, dx, dy);
+	    fontinfo->outlines_missing = 1;
+	}
 	g->unicode = 0;
+	fontinfo->invalidateGfxFont();
     }
-    if(uLen && ((u[0]>=32 && u[0]<g->unicode) || !g->unicode)) {
+    if(uLen && ((u[0]>=32 && u[0]<g->unicode) || !g->unicode) && g->unicode != u[0]) {
 	g->unicode = u[0];
+	fontinfo->invalidateGfxFont();
     }
     if(fontinfo->lastchar>=0 && fontinfo->lasty == y) {
 	double xshift = (x - fontinfo->lastx);
@@ -845,6 +1007,7 @@ GBool InfoOutputDev::beginType3Char(GfxState *state, double x, double y, double
 	return gTrue;
 
     current_splash_font = 0;
+    current_cached_font = 0;
 
     fontclass_t fontclass = fontclass_from_state(state);
     FontInfo* fontinfo = (FontInfo*)dict_lookup(this->fontcache, &fontclass);
@@ -868,6 +1031,7 @@ GBool InfoOutputDev::beginType3Char(GfxState *state, double x, double y, double
 	currentglyph->x2=dx;
 	currentglyph->y2=dy;
 	currentglyph->advance=dx;
+	fontinfo->invalidateGfxFont();
 	return gFalse;
     } else {
 	return gTrue;
@@ -49,6 +49,10 @@
 #include "../gfxtools.h"
 #include "../gfxfont.h"
 #include "../q.h"
+#include "fontcache.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 #define INTERNAL_FONT_SIZE 1024.0
 #define GLYPH_IS_SPACE(g) ((!(g)->line || ((g)->line->type==gfx_moveTo && !(g)->line->next)) && (g)->advance)
@@ -74,6 +78,11 @@ class FontInfo
 {
     gfxfont_t*gfxfont;
 
+    /* fonts which were handed out before new glyphs were discovered
+       (lazy page analysis). Devices may still reference them. */
+    gfxfontlist_t*retired_gfxfonts;
+    int generation;
+
     char*id;
     double scale;
     
@@ -85,6 +94,7 @@ public:
 
     gfxmatrix_t get_gfxmatrix(GfxState*state);
     gfxfont_t* getGfxFont();
+    void invalidateGfxFont();
 
     char usesSpaces();
 
@@ -103,6 +113,7 @@ public:
     GlyphInfo**glyphs;
 
     char seen;
+    char outlines_missing; // some glyphs were collected without outlines
     int space_char;
     float average_advance;
 
@@ -125,6 +136,13 @@ class InfoOutputDev: public OutputDev
     FontInfo*current_type3_font;
     SplashFont*current_splash_font;
 
+    FontCache*diskcache;
+    CachedFont*current_cached_font;
+
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t mutex;
+#endif
+
     public:
     int x1,y1,x2,y2;
     int num_links;
@@ -137,14 +155,29 @@ class InfoOutputDev: public OutputDev
     int num_text_breaks;
     double average_char_size;
 
+    /* if set, don't look at anything but text (and the fonts used by it) */
+    char only_text;
+
     void dumpfonts(gfxdevice_t*dev);
     FontInfo* getFontInfo(GfxState*state);
+    void loadGlyphOutlines(GfxState*state, FontInfo*fontinfo);
+
+    /* The font tables are shared by all pages of a document. These
+       serialize the analysis of pages and all modifications of fonts done
+       while rendering, if pages are rendered from several threads. */
+    void lock();
+    void unlock();
+
+    /* reuse glyph outlines of embedded fonts from earlier runs.
+       The cache is written back and deleted with this device. */
+    void setFontCache(FontCache*cache);
 
     InfoOutputDev(XRef*xref);
     virtual ~InfoOutputDev(); 
     virtual GBool useTilingPatternFill();
     virtual GBool upsideDown();
     virtual GBool needNonText();
+    virtual GBool needOnlyText();
     virtual GBool useDrawChar();
     virtual GBool interpretType3Chars();
     virtual GBool checkPageSlice(Page *page, double hDPI, double vDPI,
@@ -203,6 +236,7 @@ class InfoOutputDev: public OutputDev
     private:
     
     FontInfo* getOrCreateFontInfo(GfxState*state);
+    SplashFont* loadSplashFont(GfxState*state);
 };
 
 #endif //__infooutputdev_h__
@@ -28,6 +28,9 @@
 #include <math.h>
 
 #include "../../config.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 //xpdf header files
 #include "popplercompat.h"
@@ -96,6 +99,8 @@ VectorGraphicOutputDev::VectorGraphicOutputDev(InfoOutputDev*info, PDFDoc*doc, i
     this->current_fontinfo = 0;
     this->current_text_stroke = 0;
     this->current_text_clip = 0;
+    this->imagecache = 0;
+    this->path_arena = gfxarena_new();
     this->outer_clip_box = 0;
     this->config_convertgradients=1;
     this->config_transparent=0;
@@ -139,6 +144,139 @@ void VectorGraphicOutputDev::setDevice(gfxdevice_t*dev)
     charDev->setDevice(dev);
 }
 
+void VectorGraphicOutputDev::setImageCache(ImageCache*cache)
+{
+    this->imagecache = cache;
+}
+
+ImageCache::ImageCache(int budget)
+{
+    this->first = 0;
+    this->last = 0;
+    this->used = 0;
+    this->budget = budget;
+    this->mutex = 0;
+#ifdef HAVE_PTHREADS
+    this->mutex = malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init((pthread_mutex_t*)this->mutex, 0);
+#endif
+}
+
+ImageCache::~ImageCache()
+{
+    while(first) {
+	ImageCacheEntry*e = first;
+	unlink(e);
+	free(e->data);
+	free(e);
+    }
+#ifdef HAVE_PTHREADS
+    pthread_mutex_destroy((pthread_mutex_t*)this->mutex);
+    free(this->mutex);
+#endif
+}
+
+static void imagecache_lock(void*mutex)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock((pthread_mutex_t*)mutex);
+#endif
+}
+static void imagecache_unlock(void*mutex)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock((pthread_mutex_t*)mutex);
+#endif
+}
+
+void ImageCache::unlink(ImageCacheEntry*e)
+{
+    if(e->prev) e->prev->next = e->next;
+    else first = e->next;
+    if(e->next) e->next->prev = e->prev;
+    else last = e->prev;
+    e->prev = e->next = 0;
+    used -= e->size;
+}
+
+void ImageCache::evict()
+{
+    while(used > budget && last) {
+	ImageCacheEntry*e = last;
+	unlink(e);
+	free(e->data);
+	free(e);
+    }
+}
+
+void ImageCache::setBudget(int budget)
+{
+    imagecache_lock(mutex);
+    this->budget = budget;
+    evict();
+    imagecache_unlock(mutex);
+}
+
+ImageCacheEntry* ImageCache::find(ImageCacheKey*key)
+{
+    ImageCacheEntry*e = first;
+    while(e) {
+	if(!memcmp(&e->key, key, sizeof(ImageCacheKey)))
+	    return e;
+	e = e->next;
+    }
+    return 0;
+}
+
+gfxcolor_t* ImageCache::lookup(ImageCacheKey*key, int*width, int*height)
+{
+    imagecache_lock(mutex);
+    ImageCacheEntry*e = find(key);
+    if(!e) {
+	imagecache_unlock(mutex);
+	return 0;
+    }
+    /* move to front */
+    unlink(e);
+    e->next = first;
+    if(first) first->prev = e;
+    first = e;
+    if(!last) last = e;
+    used += e->size;
+
+    gfxcolor_t*data = new gfxcolor_t[e->width*e->height];
+    memcpy(data, e->data, e->size);
+    *width = e->width;
+    *height = e->height;
+    imagecache_unlock(mutex);
+    return data;
+}
+
+void ImageCache::store(ImageCacheKey*key, gfxcolor_t*data, int width, int height)
+{
+    int size = width*height*sizeof(gfxcolor_t);
+    imagecache_lock(mutex);
+    if(size > budget || find(key)) {
+	/* too big, or another thread stored it in the meantime */
+	imagecache_unlock(mutex);
+	return;
+    }
+    ImageCacheEntry*e = (ImageCacheEntry*)rfx_calloc(sizeof(ImageCacheEntry));
+    e->key = *key;
+    e->data = (gfxcolor_t*)malloc(size);
+    memcpy(e->data, data, size);
+    e->width = width;
+    e->height = height;
+    e->size = size;
+    e->next = first;
+    if(first) first->prev = e;
+    first = e;
+    if(!last) last = e;
+    used += size;
+    evict();
+    imagecache_unlock(mutex);
+}
+
 //void VectorGraphicOutputDev::drawImageMask(GfxState *state, Object *ref, Stream *str, int width, int height, GBool invert, GBool inlineImg) {printf("void VectorGraphicOutputDev::drawImageMask(GfxState *state, Object *ref, Stream *str, int width, int height, GBool invert, GBool inlineImg) \n");}
 //void VectorGraphicOutputDev::drawImage(GfxState *state, Object *ref, Stream *str, int width, int height, GfxImageColorMap *colorMap, GBool inlineImg) {printf("void VectorGraphicOutputDev::drawImage(GfxState *state, Object *ref, Stream *str, int width, int height, GfxImageColorMap *colorMap, GBool inlineImg) \n");}
 
@@ -200,7 +338,7 @@ gfxline_t* VectorGraphicOutputDev::gfxPath_to_gfxline(GfxState*state, GfxPath*pa
 	return 0;
     }
     gfxdrawer_t draw;
-    gfxdrawer_target_gfxline(&draw);
+    gfxdrawer_target_gfxpath(&draw, path_arena);
 
     for(t = 0; t < num; t++) {
 	GfxSubpath *subpath = path->getSubpath(t);
@@ -246,11 +384,9 @@ gfxline_t* VectorGraphicOutputDev::gfxPath_to_gfxline(GfxState*state, GfxPath*pa
     if(closed && needsfix && (fabs(posx-lastx)+fabs(posy-lasty))>0.001) {
 	draw.lineTo(&draw, lastx, lasty);
     }
-    gfxline_t*result = (gfxline_t*)draw.result(&draw);
-
-    gfxline_optimize(result);
-
-    return result;
+    gfxpath_t*packed = (gfxpath_t*)draw.result(&draw);
+    gfxpath_optimize(packed);
+    return gfxline_from_gfxpath(packed);
 }
 
 GBool VectorGraphicOutputDev::useTilingPatternFill()
@@ -659,6 +795,7 @@ VectorGraphicOutputDev::~VectorGraphicOutputDev()
 {
     finish();
     delete charDev;charDev=0;
+    gfxarena_destroy(path_arena);path_arena=0;
 };
 GBool VectorGraphicOutputDev::upsideDown() 
 {
@@ -880,6 +1017,8 @@ void VectorGraphicOutputDev::beginPage(GfxState *state, int pageNum)
     states[statepos].dashLength = 0;
     states[statepos].dashStart = 0;
     
+    gfxarena_reset(path_arena);
+
     charDev->startPage(pageNum, state);
 }
 
@@ -1089,6 +1228,102 @@ void drawimagelossless(gfxdevice_t*dev, gfxcolor_t*mem, int sizex,int sizey,
 }
 
 
+/* converts one decoded row of 8 bit RGB samples (as returned by
+   ImageStream::getLine) to opaque gfxcolor_t pixels */
+static void rgb_row_to_gfxcolor_c(gfxcolor_t*out, const Guchar*in, int n)
+{
+    int x;
+    for(x=0;x<n;x++) {
+	out[x].a = 255;
+	out[x].r = in[x*3+0];
+	out[x].g = in[x*3+1];
+	out[x].b = in[x*3+2];
+    }
+}
+
+#if defined(__SSE2__) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define HAVE_SSSE3_KERNELS
+#include <tmmintrin.h>
+
+/* four pixels at a time: spread r,g,b into the upper three bytes of
+   each gfxcolor_t and set a (the lowest byte) to 255. Every load reads
+   16 bytes, so stop while at least 18 bytes of input are left. */
+__attribute__((target("ssse3")))
+static void rgb_row_to_gfxcolor_ssse3(gfxcolor_t*out, const Guchar*in, int n)
+{
+    const __m128i shuf = _mm_setr_epi8(-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11);
+    const __m128i alpha = _mm_set1_epi32(0xff);
+    int x;
+    for(x=0;x+6<=n;x+=4) {
+	__m128i p = _mm_loadu_si128((const __m128i*)&in[x*3]);
+	_mm_storeu_si128((__m128i*)&out[x], _mm_or_si128(_mm_shuffle_epi8(p, shuf), alpha));
+    }
+    rgb_row_to_gfxcolor_c(&out[x], &in[x*3], n-x);
+}
+#endif
+
+typedef void (*rgb_row_func_t)(gfxcolor_t*out, const Guchar*in, int n);
+
+static rgb_row_func_t get_rgb_row_func()
+{
+    static rgb_row_func_t func = 0;
+    if(func)
+	return func;
+    rgb_row_func_t f = rgb_row_to_gfxcolor_c;
+#if defined(HAVE_SSSE3_KERNELS)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3"))
+	f = rgb_row_to_gfxcolor_ssse3;
+#endif
+    return func = f;
+}
+
+/* fills pal[0..2^bits-1] with the colors of a single component image.
+   The remaining entries are never indexed, and set to black. */
+static void make_palette(GfxImageColorMap*colorMap, gfxcolor_t*pal)
+{
+    int n = 1 << colorMap->getBits();
+    Guchar pixBuf[gfxColorMaxComps];
+    GfxRGB rgb;
+    int t;
+    memset(pal, 0, sizeof(gfxcolor_t)*256);
+    for(t=0;t<n && t<256;t++) {
+	pixBuf[0] = t;
+	colorMap->getRGB(pixBuf, &rgb);
+	pal[t].r = (unsigned char)(colToByte(rgb.r));
+	pal[t].g = (unsigned char)(colToByte(rgb.g));
+	pal[t].b = (unsigned char)(colToByte(rgb.b));
+	pal[t].a = 255;
+    }
+}
+
+/* DeviceRGB maps every component on its own, so instead of calling
+   getRGB for every pixel, we can look each sample up in a table.
+   Returns 0 for all other color spaces. Sets *identity if the tables
+   don't change anything (i.e., the image has the default decode array). */
+static char make_component_tables(GfxImageColorMap*colorMap, unsigned char tab[3][256], char*identity)
+{
+    if(colorMap->getNumPixelComps()!=3 || colorMap->getBits()>8 ||
+       colorMap->getColorSpace()->getMode()!=csDeviceRGB)
+	return 0;
+    int n = 1 << colorMap->getBits();
+    Guchar pixBuf[gfxColorMaxComps];
+    GfxRGB rgb;
+    int t;
+    memset(tab, 0, 3*256);
+    *identity = n==256;
+    for(t=0;t<n;t++) {
+	pixBuf[0] = pixBuf[1] = pixBuf[2] = t;
+	colorMap->getRGB(pixBuf, &rgb);
+	tab[0][t] = (unsigned char)(colToByte(rgb.r));
+	tab[1][t] = (unsigned char)(colToByte(rgb.g));
+	tab[2][t] = (unsigned char)(colToByte(rgb.b));
+	if(tab[0][t]!=t || tab[1][t]!=t || tab[2][t]!=t)
+	    *identity = 0;
+    }
+    return 1;
+}
+
 void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stream *str,
 				   int width, int height, GfxImageColorMap*colorMap, GBool invert,
 				   GBool inlineImg, int mask, int*maskColors,
@@ -1108,10 +1343,55 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
     ncomps = colorMap->getNumPixelComps();
     bits = colorMap->getBits();
   }
+
+  /* images drawn through an XObject reference decode to the same pixels
+     every time, unless they are stencil masks (which use the fill color)
+     or type 3 bitmaps (which get antialiased to their size on the page) */
+  ImageCacheKey key;
+  char cacheable = imagecache && ref && ref->isRef() && !inlineImg && !mask && !type3active && colorMap;
+  if(cacheable) {
+      memset(&key, 0, sizeof(key));
+      key.num = ref->getRef().num;
+      key.gen = ref->getRef().gen;
+      key.width = width;
+      key.height = height;
+      key.ncomps = ncomps;
+      key.bits = bits;
+      key.mode = colorMap->getColorSpace()->getMode();
+      int t;
+      for(t=0;t<ncomps && t<gfxColorMaxComps;t++) {
+	  key.decode[t*2] = colorMap->getDecodeLow(t);
+	  key.decode[t*2+1] = colorMap->getDecodeHigh(t);
+      }
+      if(maskColors) {
+	  for(t=0;t<2*ncomps && t<2*gfxColorMaxComps;t++)
+	      key.maskColors[t] = maskColors[t];
+	  key.maskColors[0] |= 0x10000; // distinguish from no mask colors
+      }
+      if(maskStr) {
+	  key.maskWidth = maskWidth;
+	  key.maskHeight = maskHeight;
+	  key.maskInvert = maskInvert;
+	  key.softMask = maskColorMap!=0;
+      }
+      int cachedwidth, cachedheight;
+      gfxcolor_t*pic = imagecache->lookup(&key, &cachedwidth, &cachedheight);
+      if(pic) {
+	  this->transformXY(state, 0, 1, &x1, &y1);
+	  this->transformXY(state, 0, 0, &x2, &y2);
+	  this->transformXY(state, 1, 0, &x3, &y3);
+	  this->transformXY(state, 1, 1, &x4, &y4);
+	  if(str->getKind()==strDCT)
+	      drawimagejpeg(device, pic, cachedwidth, cachedheight, x1,y1,x2,y2,x3,y3,x4,y4, config_multiply);
+	  else
+	      drawimagelossless(device, pic, cachedwidth, cachedheight, x1,y1,x2,y2,x3,y3,x4,y4, config_multiply);
+	  delete[] pic;
+	  return;
+      }
+  }
       
   if(maskStr) {
       int x,y;
-      unsigned char buf[8];
       maskbitmap = (unsigned char*)malloc(maskHeight*maskWidth);
       if(maskColorMap) {
 	  ImageStream*imgMaskStr = new ImageStream(maskStr, maskWidth, maskColorMap->getNumPixelComps(), maskColorMap->getBits());
@@ -1125,21 +1405,26 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
 	      maskColorMap->getGray(pixBuf, &gray);
 	      pal[t] = colToByte(gray);
 	  }
+	  int mcomps = maskColorMap->getNumPixelComps();
 	  for (y = 0; y < maskHeight; y++) {
+	      Guchar*line = imgMaskStr->getLine();
+	      unsigned char*m = &maskbitmap[y*maskWidth];
 	      for (x = 0; x < maskWidth; x++) {
-		  imgMaskStr->getPixel(buf);
-		  maskbitmap[y*maskWidth+x] = pal[buf[0]];
+		  m[x] = pal[line[x*mcomps]];
 	      }
 	  }
 	  delete imgMaskStr;
       } else {
 	  ImageStream*imgMaskStr = new ImageStream(maskStr, maskWidth, 1, 1);
       	  imgMaskStr->reset();
+	  unsigned char pal[2];
+	  pal[0] = maskInvert?0:255;
+	  pal[1] = maskInvert?255:0;
 	  for (y = 0; y < maskHeight; y++) {
+	      Guchar*line = imgMaskStr->getLine();
+	      unsigned char*m = &maskbitmap[y*maskWidth];
 	      for (x = 0; x < maskWidth; x++) {
-		  imgMaskStr->getPixel(buf);
-		  buf[0]^=maskInvert;
-		  maskbitmap[y*maskWidth+x] = (buf[0]^1)*255;
+		  m[x] = pal[line[x]];
 	      }
 	  }
 	  delete imgMaskStr;
@@ -1153,12 +1438,9 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
   if(!width || !height || ((height+width)<=1 && (maskWidth+maskHeight)<=1))
   {
       msg("<verbose> Ignoring %d by %d image", width, height);
-      unsigned char buf[8];
-      int x,y;
+      int y;
       for (y = 0; y < height; ++y)
-      for (x = 0; x < width; ++x) {
-	  imgStr->getPixel(buf);
-      }
+	  imgStr->skipLine();
       delete imgStr;
       if(maskbitmap)
 	  free(maskbitmap);
@@ -1193,7 +1475,6 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
   }
 
   if(mask) {
-      unsigned char buf[8];
       int x,y;
       unsigned char*pic = new unsigned char[width*height];
       gfxcolor_t pal[256];
@@ -1209,13 +1490,15 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
       int numpalette = 2;
       int realwidth = (int)sqrt(SQR(x2-x3) + SQR(y2-y3));
       int realheight = (int)sqrt(SQR(x1-x2) + SQR(y1-y2));
-      for (y = 0; y < height; ++y)
-      for (x = 0; x < width; ++x)
-      {
-	    imgStr->getPixel(buf);
-	    if(invert) 
-		buf[0]=1-buf[0];
-	    pic[width*y+x] = buf[0];
+      for (y = 0; y < height; ++y) {
+	  Guchar*line = imgStr->getLine();
+	  unsigned char*p = &pic[width*y];
+	  if(invert) {
+	      for (x = 0; x < width; ++x)
+		  p[x] = 1-line[x];
+	  } else {
+	      memcpy(p, line, width);
+	  }
       }
      
       if(type3active) {
@@ -1266,15 +1549,42 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
 
   if(colorMap->getNumPixelComps()!=1 || str->getKind()==strDCT) {
       gfxcolor_t*pic=new gfxcolor_t[width*height];
+      gfxcolor_t pal[256];
+      unsigned char tab[3][256];
+      char identity = 0;
+      char separable = 0;
+      if(ncomps==1 && bits<=8) {
+	  make_palette(colorMap, pal);
+      } else {
+	  separable = make_component_tables(colorMap, tab, &identity);
+      }
+      rgb_row_func_t rgb_row = get_rgb_row_func();
       for (y = 0; y < height; ++y) {
-	for (x = 0; x < width; ++x) {
-	  imgStr->getPixel(pixBuf);
-	  colorMap->getRGB(pixBuf, &rgb);
-	  pic[width*y+x].r = (unsigned char)(colToByte(rgb.r));
-	  pic[width*y+x].g = (unsigned char)(colToByte(rgb.g));
-	  pic[width*y+x].b = (unsigned char)(colToByte(rgb.b));
-	  pic[width*y+x].a = 255;//(U8)(rgb.a * 255 + 0.5);
-	  if(maskbitmap) {
+	Guchar*line = imgStr->getLine();
+	gfxcolor_t*p = &pic[width*y];
+	if(ncomps==1 && bits<=8) {
+	  for (x = 0; x < width; ++x)
+	    p[x] = pal[line[x]];
+	} else if(identity) {
+	  rgb_row(p, line, width);
+	} else if(separable) {
+	  for (x = 0; x < width; ++x) {
+	    p[x].r = tab[0][line[x*3+0]];
+	    p[x].g = tab[1][line[x*3+1]];
+	    p[x].b = tab[2][line[x*3+2]];
+	    p[x].a = 255;
+	  }
+	} else {
+	  for (x = 0; x < width; ++x) {
+	    colorMap->getRGB(&line[x*ncomps], &rgb);
+	    p[x].r = (unsigned char)(colToByte(rgb.r));
+	    p[x].g = (unsigned char)(colToByte(rgb.g));
+	    p[x].b = (unsigned char)(colToByte(rgb.b));
+	    p[x].a = 255;//(U8)(rgb.a * 255 + 0.5);
+	  }
+	}
+	if(maskbitmap) {
+	  for (x = 0; x < width; ++x) {
               int x1 = x*maskWidth/width;
               int y1 = y*maskHeight/height;
               int x2 = (x+1)*maskWidth/width;
@@ -1295,6 +1605,8 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
 	  }
 	}
       }
+      if(cacheable)
+	  imagecache->store(&key, pic, width, height);
       if(str->getKind()==strDCT)
 	  drawimagejpeg(device, pic, width, height, x1,y1,x2,y2,x3,y3,x4,y4, config_multiply);
       else
@@ -1306,23 +1618,16 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
   } else {
       gfxcolor_t*pic=new gfxcolor_t[width*height];
       gfxcolor_t pal[256];
-      int n = 1 << colorMap->getBits();
-      int t;
-      for(t=0;t<256;t++) {
-	  pixBuf[0] = t;
-	  colorMap->getRGB(pixBuf, &rgb);
-	  pal[t].r = (unsigned char)(colToByte(rgb.r));
-	  pal[t].g = (unsigned char)(colToByte(rgb.g));
-	  pal[t].b = (unsigned char)(colToByte(rgb.b));
-	  pal[t].a = 255;//(U8)(rgb.b * 255 + 0.5);
+      make_palette(colorMap, pal);
+      if(maskColors && *maskColors>=0 && *maskColors<256) {
+	  /* the key color is transparent */
+	  pal[*maskColors].a = 0;
       }
       for (y = 0; y < height; ++y) {
+	Guchar*line = imgStr->getLine();
+	gfxcolor_t*p = &pic[width*y];
 	for (x = 0; x < width; ++x) {
-	  imgStr->getPixel(pixBuf);
-	  pic[width*y+x] = pal[pixBuf[0]];
-	  if(maskColors && *maskColors==pixBuf[0]) {
-	      pic[width*y+x].a = 0;
-	  }
+	  p[x] = pal[line[x]];
 	}
       }
       if(maskbitmap) {
@@ -1353,6 +1658,8 @@ void VectorGraphicOutputDev::drawGeneralImage(GfxState *state, Object *ref, Stre
 	      height = maskHeight;
 	  }
       }
+      if(cacheable)
+	  imagecache->store(&key, pic, width, height);
       drawimagelossless(device, pic, width, height, x1,y1,x2,y2,x3,y3,x4,y4, config_multiply);
 
       delete[] pic;
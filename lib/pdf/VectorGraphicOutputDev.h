@@ -44,6 +44,51 @@ void addGlobalFontDir(const char*dirname);
 
 class GFXLink;
   
+/* identifies a decoded image: the XObject, and everything in the color
+   map and mask which influences the decoded pixels */
+struct ImageCacheKey {
+    int num, gen;
+    int width, height;
+    int ncomps, bits, mode;
+    double decode[2*gfxColorMaxComps];
+    int maskColors[2*gfxColorMaxComps];
+    int maskWidth, maskHeight, maskInvert, softMask;
+};
+
+struct ImageCacheEntry {
+    ImageCacheKey key;
+    gfxcolor_t*data;
+    int width, height;
+    int size;
+    ImageCacheEntry*prev;
+    ImageCacheEntry*next;
+};
+
+/* A least-recently-used cache of decoded images, shared by all pages
+   of a document. Its size is bounded by the budget (in bytes).
+   Devices may modify the pixels they're given (e.g. to premultiply
+   alpha), so the cache only ever hands out and stores copies. */
+class ImageCache {
+public:
+    ImageCache(int budget);
+    ~ImageCache();
+    void setBudget(int budget);
+
+    /* returns a copy of the cached pixels (allocated with new[]), or NULL */
+    gfxcolor_t* lookup(ImageCacheKey*key, int*width, int*height);
+    void store(ImageCacheKey*key, gfxcolor_t*data, int width, int height);
+
+private:
+    void unlink(ImageCacheEntry*e);
+    void evict();
+    ImageCacheEntry*find(ImageCacheKey*key);
+    ImageCacheEntry*first;
+    ImageCacheEntry*last;
+    int used;
+    int budget;
+    void*mutex;
+};
+
 void drawchar_callback(gfxdevice_t*dev, gfxfont_t*font, int glyph, gfxcolor_t*color, gfxmatrix_t*matrix);
 void addfont_callback(gfxdevice_t*dev, gfxfont_t*font);
 
@@ -56,6 +101,7 @@ public:
 
   virtual void setDevice(gfxdevice_t*dev);
   virtual void setParameter(const char*key, const char*value);
+  void setImageCache(ImageCache*cache);
   
   // Start a page.
   virtual void beginPage(GfxState *state, int pageNum);
@@ -192,6 +238,10 @@ virtual POPPLER_TILING_PATERN_RETURN tilingPatternFill(GfxState *state,
 
   gfxline_t* current_text_stroke;
   gfxline_t* current_text_clip;
+  ImageCache* imagecache;
+
+  /* scratch memory for paths, reset at every page */
+  gfxarena_t* path_arena;
   gfxfont_t* current_gfxfont;
   FontInfo*current_fontinfo;
   gfxmatrix_t current_font_matrix;
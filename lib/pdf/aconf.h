@@ -15,6 +15,12 @@
 
 #define TEXTOUT_WORD_LIST 1
 
+/* lock globalParams and the CMap/UnicodeMap caches, so that pages
+   can be rendered from several threads (gfx2gfx -j) */
+#ifdef HAVE_PTHREADS
+#define MULTITHREADED 1
+#endif
+
 // todo:
 //
 // HAVE_STRINGS_H
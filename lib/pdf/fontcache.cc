@@ -0,0 +1,387 @@
+/* fontcache.cc
+   An on-disk cache for the glyph outlines InfoOutputDev extracts from
+   embedded fonts.
+
+   This file is part of swftools.
+
+   Swftools is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   Swftools is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with swftools; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "../../config.h"
+#include "fontcache.h"
+#include "../log.h"
+#include "../os.h"
+#include "../types.h"
+#include "../bitio.h"
+
+/* bump this if anything changes the glyph paths we get for a given font
+   file, e.g. the size InfoOutputDev loads fonts at */
+#define FONTCACHE_MAGIC "gfxfc001"
+#define FONTCACHE_HEADER_SIZE 16
+
+typedef struct _fonthash {
+    U64 fnv;
+    U32 crc;
+} fonthash_t;
+
+static void hash_add(fonthash_t*h, const void*data, int len)
+{
+    const unsigned char*p = (const unsigned char*)data;
+    int t;
+    for(t=0;t<len;t++) {
+	h->fnv ^= p[t];
+	h->fnv *= 0x100000001b3ull;
+    }
+    h->crc = crc32_add_bytes(h->crc, data, len);
+}
+static void hash_add_int(fonthash_t*h, int i)
+{
+    unsigned char b[4] = {(unsigned char)i, (unsigned char)(i>>8), (unsigned char)(i>>16), (unsigned char)(i>>24)};
+    hash_add(h, b, 4);
+}
+static void hash_add_string(fonthash_t*h, const char*s)
+{
+    if(!s) {
+	hash_add_int(h, -1);
+    } else {
+	int l = strlen(s);
+	hash_add_int(h, l);
+	hash_add(h, s, l);
+    }
+}
+
+CachedFont::CachedFont(const char*filename)
+{
+    this->filename = strdup(filename);
+    this->glyphs = 0;
+    this->num_glyphs = 0;
+    this->dirty = 0;
+    this->ascender = 0;
+    this->descender = 0;
+    this->has_metrics = 0;
+}
+
+CachedFont::~CachedFont()
+{
+    int t;
+    for(t=0;t<num_glyphs;t++) {
+	if(glyphs[t]) {
+	    free(glyphs[t]->xy);
+	    free(glyphs[t]->flags);
+	    free(glyphs[t]);
+	}
+    }
+    free(glyphs);glyphs=0;
+    free(filename);filename=0;
+}
+
+void CachedFont::setMetrics(double ascender, double descender)
+{
+    if(has_metrics && this->ascender == ascender && this->descender == descender)
+	return;
+    this->ascender = ascender;
+    this->descender = descender;
+    this->has_metrics = 1;
+    this->dirty = 1;
+}
+
+char CachedFont::getGlyph(int code, SplashPath**path, double*advance)
+{
+    if(code<0 || code>=num_glyphs || !glyphs[code])
+	return 0;
+    cachedglyph_t*g = glyphs[code];
+    *advance = g->advance;
+    if(g->num_points<0) {
+	*path = 0;
+	return 1;
+    }
+    /* replaying the points through moveTo/lineTo/curveTo/close
+       reproduces the flags of the original path */
+    SplashPath*p = new SplashPath();
+    int s;
+    for(s=0;s<g->num_points;s++) {
+	double*xy = &g->xy[s*2];
+	unsigned char f = g->flags[s];
+	if(f&splashPathFirst) {
+	    p->moveTo(xy[0], xy[1]);
+	} else if((f&splashPathCurve) && s+2<g->num_points) {
+	    p->curveTo(xy[0], xy[1], xy[2], xy[3], xy[4], xy[5]);
+	    s+=2;
+	    f = g->flags[s];
+	} else {
+	    p->lineTo(xy[0], xy[1]);
+	}
+	if((f&splashPathLast) && (f&splashPathClosed)) {
+	    p->close();
+	}
+    }
+    *path = p;
+    return 1;
+}
+
+void CachedFont::addGlyph(int code, SplashPath*path, double advance)
+{
+    if(code<0)
+	return;
+    if(code >= num_glyphs) {
+	glyphs = (cachedglyph_t**)realloc(glyphs, sizeof(cachedglyph_t*)*(code+1));
+	memset(&glyphs[num_glyphs], 0, sizeof(cachedglyph_t*)*(code+1-num_glyphs));
+	num_glyphs = code+1;
+    }
+    if(glyphs[code])
+	return;
+    cachedglyph_t*g = (cachedglyph_t*)calloc(1, sizeof(cachedglyph_t));
+    g->advance = advance;
+    if(!path) {
+	g->num_points = -1;
+    } else {
+	int len = path->getLength();
+	g->num_points = len;
+	g->xy = (double*)malloc(sizeof(double)*2*(len+1));
+	g->flags = (unsigned char*)malloc(len+1);
+	int s;
+	for(s=0;s<len;s++) {
+	    Guchar f;
+	    path->getPoint(s, &g->xy[s*2], &g->xy[s*2+1], &f);
+	    g->flags[s] = f;
+	}
+    }
+    glyphs[code] = g;
+    dirty = 1;
+}
+
+/* file format: magic, payload length, crc32 of the payload, and then
+   ascender, descender, number of glyphs and per glyph: code, advance,
+   number of points (-1: no outline), coordinates and flags */
+char CachedFont::load()
+{
+    if(!file_exists(filename))
+	return 0;
+    memfile_t*file = memfile_open(filename);
+    if(!file)
+	return 0;
+    unsigned char*data = (unsigned char*)file->data;
+    int len = file->len;
+    char ok = 0;
+    if(len >= FONTCACHE_HEADER_SIZE && !memcmp(data, FONTCACHE_MAGIC, 8)) {
+	reader_t r;
+	reader_init_memreader(&r, data+8, 8);
+	U32 size = reader_readU32(&r);
+	U32 crc = reader_readU32(&r);
+	r.dealloc(&r);
+	if(size == (U32)(len - FONTCACHE_HEADER_SIZE) &&
+	   crc == crc32_add_bytes(0, data+FONTCACHE_HEADER_SIZE, size)) {
+	    ok = 1;
+	}
+    }
+    if(!ok) {
+	msg("<warning> Ignoring broken font cache file %s", filename);
+	memfile_close(file);
+	return 0;
+    }
+
+    reader_t r;
+    reader_init_memreader(&r, data+FONTCACHE_HEADER_SIZE, len-FONTCACHE_HEADER_SIZE);
+    ascender = reader_readDouble(&r);
+    descender = reader_readDouble(&r);
+    has_metrics = 1;
+    int num = reader_readU32(&r);
+    int t;
+    for(t=0;t<num;t++) {
+	int code = reader_readU32(&r);
+	double advance = reader_readDouble(&r);
+	int num_points = reader_readU32(&r);
+	if(code < 0 || code > 0x10ffff || num_points > (len - FONTCACHE_HEADER_SIZE - r.pos) / 17) {
+	    msg("<warning> Ignoring broken font cache file %s", filename);
+	    break;
+	}
+	if(code >= num_glyphs) {
+	    glyphs = (cachedglyph_t**)realloc(glyphs, sizeof(cachedglyph_t*)*(code+1));
+	    memset(&glyphs[num_glyphs], 0, sizeof(cachedglyph_t*)*(code+1-num_glyphs));
+	    num_glyphs = code+1;
+	}
+	cachedglyph_t*g = (cachedglyph_t*)calloc(1, sizeof(cachedglyph_t));
+	g->advance = advance;
+	g->num_points = num_points<0?-1:num_points;
+	if(num_points>0) {
+	    g->xy = (double*)malloc(sizeof(double)*2*num_points);
+	    g->flags = (unsigned char*)malloc(num_points);
+	    int s;
+	    for(s=0;s<num_points*2;s++) {
+		g->xy[s] = reader_readDouble(&r);
+	    }
+	    r.read(&r, g->flags, num_points);
+	}
+	if(glyphs[code]) {
+	    free(glyphs[code]->xy);
+	    free(glyphs[code]->flags);
+	    free(glyphs[code]);
+	}
+	glyphs[code] = g;
+    }
+    r.dealloc(&r);
+    memfile_close(file);
+    dirty = 0;
+    return 1;
+}
+
+void CachedFont::save()
+{
+    if(!dirty || !has_metrics)
+	return;
+
+    writer_t w;
+    writer_init_growingmemwriter(&w, 4096);
+    writer_writeDouble(&w, ascender);
+    writer_writeDouble(&w, descender);
+    int num = 0;
+    int t;
+    for(t=0;t<num_glyphs;t++) {
+	if(glyphs[t])
+	    num++;
+    }
+    writer_writeU32(&w, num);
+    for(t=0;t<num_glyphs;t++) {
+	cachedglyph_t*g = glyphs[t];
+	if(!g)
+	    continue;
+	writer_writeU32(&w, t);
+	writer_writeDouble(&w, g->advance);
+	writer_writeU32(&w, (U32)g->num_points);
+	int s;
+	for(s=0;s<g->num_points*2;s++) {
+	    writer_writeDouble(&w, g->xy[s]);
+	}
+	if(g->num_points>0)
+	    w.write(&w, g->flags, g->num_points);
+    }
+    int size = 0;
+    unsigned char*data = (unsigned char*)writer_growmemwrite_memptr(&w, &size);
+
+    /* write to a temporary file first, so that other processes
+       never see a partially written entry */
+    char*tmpname = (char*)malloc(strlen(filename)+32);
+    sprintf(tmpname, "%s.%d.tmp", filename, (int)getpid());
+    FILE*fi = fopen(tmpname, "wb");
+    if(!fi) {
+	msg("<warning> Couldn't write font cache file %s", tmpname);
+    } else {
+	unsigned char header[FONTCACHE_HEADER_SIZE];
+	U32 crc = crc32_add_bytes(0, data, size);
+	memcpy(header, FONTCACHE_MAGIC, 8);
+	for(t=0;t<4;t++) {
+	    header[8+t] = size>>(t*8);
+	    header[12+t] = crc>>(t*8);
+	}
+	char ok = fwrite(header, FONTCACHE_HEADER_SIZE, 1, fi) == 1 &&
+	          (!size || fwrite(data, size, 1, fi) == 1);
+	ok = !fclose(fi) && ok;
+	if(ok) {
+	    move_file(tmpname, filename);
+	    dirty = 0;
+	} else {
+	    msg("<warning> Couldn't write font cache file %s", tmpname);
+	}
+	unlink(tmpname);
+    }
+    free(tmpname);
+    w.finish(&w);
+}
+
+FontCache::FontCache(XRef*xref, const char*dir)
+{
+    this->xref = xref;
+    this->dir = strdup(dir);
+    this->fonts = dict_new();
+    this->files = dict_new();
+}
+
+FontCache::~FontCache()
+{
+    /* several font objects may share a CachedFont, but each file has
+       exactly one */
+    DICT_ITERATE_DATA(this->files, CachedFont*, f) {
+	f->save();
+	delete f;
+    }
+    dict_destroy(this->files);this->files=0;
+    dict_destroy(this->fonts);this->fonts=0;
+    free(this->dir);this->dir=0;
+}
+
+CachedFont* FontCache::getFont(GfxFont*font)
+{
+    Ref*id = font->getID();
+    if(id->num < 0)
+	return 0;
+    char key[64];
+    sprintf(key, "%d %d", id->num, id->gen);
+    if(dict_contains(this->fonts, key))
+	return (CachedFont*)dict_lookup(this->fonts, key);
+
+    CachedFont*cached = 0;
+    Ref embRef;
+    int len = 0;
+    char*file = 0;
+    if(font->getType() != fontType3 && font->getEmbeddedFontID(&embRef))
+	file = font->readEmbFontFile(this->xref, &len);
+    if(file) {
+	/* the glyph for a char code depends on the font program, and on
+	   how the PDF maps codes to glyph names or ids */
+	fonthash_t h = {0xcbf29ce484222325ull, 0};
+	hash_add_int(&h, font->getType());
+	hash_add_int(&h, font->getFlags());
+	hash_add_int(&h, len);
+	hash_add(&h, file, len);
+	if(font->isCIDFont()) {
+	    GfxCIDFont*cid = (GfxCIDFont*)font;
+	    int n = cid->getCIDToGIDLen();
+	    hash_add_int(&h, n);
+	    if(n)
+		hash_add(&h, cid->getCIDToGID(), n*sizeof(Gushort));
+	} else {
+	    Gfx8BitFont*f8 = (Gfx8BitFont*)font;
+	    char**enc = f8->getEncoding();
+	    int t;
+	    for(t=0;t<256;t++) {
+		hash_add_string(&h, enc[t]);
+	    }
+	    hash_add_int(&h, f8->getHasEncoding());
+	    hash_add_int(&h, f8->getUsesMacRomanEnc());
+	}
+	gfree(file);
+
+	char name[64];
+	sprintf(name, "%016llx%08x.glyphs", (unsigned long long)h.fnv, h.crc);
+	cached = (CachedFont*)dict_lookup(this->files, name);
+	if(!cached) {
+	    char*filename = concatPaths(this->dir, name);
+	    cached = new CachedFont(filename);
+	    free(filename);
+	    if(cached->load()) {
+		msg("<verbose> Loaded glyphs of font %s from %s", font->getName()?font->getName()->getCString():"", name);
+	    }
+	    dict_put(this->files, name, cached);
+	}
+    }
+    dict_put(this->fonts, key, cached);
+    return cached;
+}
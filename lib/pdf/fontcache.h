@@ -0,0 +1,91 @@
+/* fontcache.h
+   An on-disk cache for the glyph outlines InfoOutputDev extracts from
+   embedded fonts.
+
+   This file is part of swftools.
+
+   Swftools is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   Swftools is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with swftools; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __fontcache_h__
+#define __fontcache_h__
+
+#include "popplercompat.h"
+#include "GfxFont.h"
+#include "XRef.h"
+#ifdef HAVE_POPPLER
+  #include <splash/SplashPath.h>
+#else
+  #include "SplashPath.h"
+#endif
+#include "../q.h"
+
+/* the outline (as returned by SplashFont::getGlyphPath) and advance
+   of a single char code */
+typedef struct _cachedglyph {
+    double advance;
+    int num_points; // -1 if the font has no outline for this char
+    double*xy;
+    unsigned char*flags;
+} cachedglyph_t;
+
+/* Everything we ever extracted from one font program. A font is
+   identified by a hash of the embedded font file together with the
+   encoding tables which map char codes to glyphs, so identical fonts
+   in different documents (or different objects of the same document)
+   share an entry. */
+class CachedFont
+{
+    char*filename;
+    cachedglyph_t**glyphs;
+    int num_glyphs;
+    char dirty;
+
+    public:
+    double ascender, descender;
+    char has_metrics;
+
+    CachedFont(const char*filename);
+    ~CachedFont();
+
+    void setMetrics(double ascender, double descender);
+
+    /* returns 0 if the char code isn't cached. Otherwise, *path is
+       a new path (or 0, if the font has no outline for the char) */
+    char getGlyph(int code, SplashPath**path, double*advance);
+    void addGlyph(int code, SplashPath*path, double advance);
+
+    char load();
+    void save();
+};
+
+/* The cache directory is shared by all processes using it. Entries
+   are read when a font is first used, and written back (replacing the
+   file as a whole) when the cache is destroyed. */
+class FontCache
+{
+    char*dir;
+    XRef*xref;
+    dict_t*fonts; // "num gen" of the font dictionary -> CachedFont
+    dict_t*files; // cache file name -> CachedFont, shared by all fonts with that hash
+
+    public:
+    FontCache(XRef*xref, const char*dir);
+    ~FontCache();
+
+    /* returns 0 for fonts which aren't embedded */
+    CachedFont* getFont(GfxFont*font);
+};
+
+#endif //__fontcache_h__
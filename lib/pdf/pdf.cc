@@ -21,12 +21,22 @@
 #define NO_ARGPARSER
 #include "../args.h"
 #include "../utf8.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 static double zoom = 72; /* xpdf: 86 */
 static int zoomtowidth = 0;
 static double multiply = 1.0;
 static char* global_page_range = 0;
 static int threadsafe = 0;
+static int lazyinfo = 0;
+static int onlytext = 0;
+static char* fontcache_dir = 0;
+
+/* in kilobytes */
+#define DEFAULT_IMAGECACHE_SIZE 32768
+static int imagecache_size = DEFAULT_IMAGECACHE_SIZE;
 
 static int globalparams_count=0;
 
@@ -48,6 +58,10 @@ typedef struct _pdf_doc_internal
     char config_print;
     gfxparams_t* parameters;
 
+    /* the global zoom and multiply settings at the time the file was opened */
+    double zoom;
+    double multiply;
+
     int protect;
     int nocopy;
     int noprint;
@@ -56,9 +70,20 @@ typedef struct _pdf_doc_internal
     GString*userPW;
     PDFDoc*doc;
 
+    /* with threadsafe=1, PDFDoc instances not currently used by a page */
+    PDFDoc**docpool;
+    int docpool_size;
+    int docpool_num;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t docpool_mutex;
+#endif
+
     Object docinfo;
     InfoOutputDev*info;
 
+    /* decoded images, shared by all pages */
+    ImageCache*imagecache;
+
     pdf_page_info_t*pages;
     char*filename;
 
@@ -72,6 +97,7 @@ typedef struct _pdf_doc_internal
 
 typedef struct _pdf_page_internal
 {
+    PDFDoc*doc; // with threadsafe=1, every page has its own PDFDoc instance
 } pdf_page_internal_t;
 
 typedef struct _dev_output_internal
@@ -95,9 +121,80 @@ static const char* dirseparator()
 #endif
 }
 
+static char page_in_range(int pagenr)
+{
+    return !global_page_range || is_in_range(pagenr, global_page_range);
+}
+
+/* run the InfoOutputDev over a single page, collecting the page's bbox
+   and adding the fonts (and glyphs) used on it to the shared font cache */
+static void analyze_page(pdf_doc_internal_t*i, int t)
+{
+    if(!page_in_range(t))
+	return;
+    i->info->lock();
+    if(i->pages[t-1].has_info) {
+	i->info->unlock();
+	return;
+    }
+    i->doc->displayPage((OutputDev*)i->info, t, i->zoom, i->zoom, /*rotate*/0, /*usemediabox*/true, /*crop*/true, i->config_print);
+    i->doc->processLinks((OutputDev*)i->info, t);
+    i->pages[t-1].xMin = i->info->x1;
+    i->pages[t-1].yMin = i->info->y1;
+    i->pages[t-1].xMax = i->info->x2;
+    i->pages[t-1].yMax = i->info->y2;
+    i->pages[t-1].width = i->info->x2 - i->info->x1;
+    i->pages[t-1].height = i->info->y2 - i->info->y1;
+    i->pages[t-1].number_of_images = i->info->num_ppm_images + i->info->num_jpeg_images;
+    i->pages[t-1].number_of_links = i->info->num_links;
+    i->pages[t-1].number_of_fonts = i->info->num_fonts;
+    i->pages[t-1].has_info = 1;
+    i->info->unlock();
+}
+
+/* pages rendered in parallel can't share a PDFDoc (xpdf's XRef and
+   object streams aren't thread safe), so with threadsafe=1 every page
+   borrows its own instance from a pool */
+static PDFDoc* docpool_get(pdf_doc_internal_t*i)
+{
+    PDFDoc*doc = 0;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&i->docpool_mutex);
+#endif
+    if(i->docpool_num) {
+	doc = i->docpool[--i->docpool_num];
+    }
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&i->docpool_mutex);
+#endif
+    if(!doc) {
+	doc = new PDFDoc(i->fileName->copy(), i->userPW);
+    }
+    return doc;
+}
+
+static void docpool_put(pdf_doc_internal_t*i, PDFDoc*doc)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&i->docpool_mutex);
+#endif
+    if(i->docpool_num == i->docpool_size) {
+	i->docpool_size += 8;
+	i->docpool = (PDFDoc**)realloc(i->docpool, sizeof(PDFDoc*)*i->docpool_size);
+    }
+    i->docpool[i->docpool_num++] = doc;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&i->docpool_mutex);
+#endif
+}
+
 void pdfpage_destroy(gfxpage_t*pdf_page)
 {
     pdf_page_internal_t*i= (pdf_page_internal_t*)pdf_page->internal;
+    if(i->doc) {
+	docpool_put((pdf_doc_internal_t*)pdf_page->parent->internal, i->doc);
+	i->doc = 0;
+    }
     free(pdf_page->internal);pdf_page->internal = 0;
     free(pdf_page);pdf_page=0;
 }
@@ -106,22 +203,27 @@ static void render2(gfxpage_t*page, gfxdevice_t*dev, int x,int y, int x1,int y1,
 {
     pdf_doc_internal_t*pi = (pdf_doc_internal_t*)page->parent->internal;
     gfxsource_internal_t*i = (gfxsource_internal_t*)pi->parent->internal;
+    pdf_page_internal_t*ppi = (pdf_page_internal_t*)page->internal;
+    PDFDoc*doc = ppi->doc ? ppi->doc : pi->doc;
+    double multiply = pi->multiply;
 
     if(!pi->config_print && pi->nocopy) {msg("<fatal> PDF disallows copying");exit(0);}
     if(pi->config_print && pi->noprint) {msg("<fatal> PDF disallows printing");exit(0);}
 
     CommonOutputDev*outputDev = 0;
     if(pi->config_full_bitmap_optimizing) {
-	FullBitmapOutputDev*d = new FullBitmapOutputDev(pi->info, pi->doc, pi->pagemap, pi->pagemap_pos, x, y, x1, y1, x2, y2);
+	FullBitmapOutputDev*d = new FullBitmapOutputDev(pi->info, doc, pi->pagemap, pi->pagemap_pos, x, y, x1, y1, x2, y2);
 	outputDev = (CommonOutputDev*)d;
     } else if(pi->config_bitmap_optimizing) {
-	BitmapOutputDev*d = new BitmapOutputDev(pi->info, pi->doc, pi->pagemap, pi->pagemap_pos, x, y, x1, y1, x2, y2);
+	BitmapOutputDev*d = new BitmapOutputDev(pi->info, doc, pi->pagemap, pi->pagemap_pos, x, y, x1, y1, x2, y2);
 	outputDev = (CommonOutputDev*)d;
     } else if(pi->config_only_text) {
-	CharOutputDev*d = new CharOutputDev(pi->info, pi->doc, pi->pagemap, pi->pagemap_pos, x, y, x1, y1, x2, y2);
+	CharOutputDev*d = new CharOutputDev(pi->info, doc, pi->pagemap, pi->pagemap_pos, x, y, x1, y1, x2, y2);
+	d->setNeedsOutlines(gFalse);
 	outputDev = (CommonOutputDev*)d;
     } else {
-	VectorGraphicOutputDev*d = new VectorGraphicOutputDev(pi->info, pi->doc, pi->pagemap, pi->pagemap_pos, x, y, x1, y1, x2, y2);
+	VectorGraphicOutputDev*d = new VectorGraphicOutputDev(pi->info, doc, pi->pagemap, pi->pagemap_pos, x, y, x1, y1, x2, y2);
+	d->setImageCache(pi->imagecache);
 	outputDev = (CommonOutputDev*)d;
     }
 
@@ -160,8 +262,8 @@ static void render2(gfxpage_t*page, gfxdevice_t*dev, int x,int y, int x1,int y1,
     }
 
     outputDev->setDevice(dev);
-    pi->doc->processLinks((OutputDev*)outputDev, page->nr);
-    pi->doc->displayPage((OutputDev*)outputDev, page->nr, zoom*multiply, zoom*multiply, /*rotate*/0, true, true, pi->config_print);
+    doc->processLinks((OutputDev*)outputDev, page->nr);
+    doc->displayPage((OutputDev*)outputDev, page->nr, pi->zoom*multiply, pi->zoom*multiply, /*rotate*/0, true, true, pi->config_print);
     outputDev->finishPage();
     outputDev->setDevice(0);
     delete outputDev;
@@ -187,6 +289,7 @@ void pdfpage_rendersection(gfxpage_t*page, gfxdevice_t*output, gfxcoord_t x, gfx
     int x1=(int)_x1,y1=(int)_y1,x2=(int)_x2,y2=(int)_y2;
     if((x1|y1|x2|y2)==0) x2++;
 
+    double multiply = pi->multiply;
     render2(page, output, (int)x*multiply,(int)y*multiply,
                           (int)x1*multiply,(int)y1*multiply,(int)x2*multiply,(int)y2*multiply);
 }
@@ -206,6 +309,14 @@ void pdf_doc_destroy(gfxdocument_t*gfx)
     if(i->doc) {
 	delete i->doc; i->doc=0;
     }
+    int t;
+    for(t=0;t<i->docpool_num;t++) {
+	delete i->docpool[t];
+    }
+    free(i->docpool);i->docpool = 0;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_destroy(&i->docpool_mutex);
+#endif
     free(i->pages); i->pages = 0;
     
     if(i->pagemap) {
@@ -221,6 +332,9 @@ void pdf_doc_destroy(gfxdocument_t*gfx)
     if(i->info) {
 	delete i->info;i->info=0;
     }
+    if(i->imagecache) {
+	delete i->imagecache;i->imagecache=0;
+    }
     if(i->parameters) {
 	gfxparams_free(i->parameters);
 	i->parameters=0;
@@ -280,6 +394,9 @@ void pdf_doc_setparameter(gfxdocument_t*gfx, const char*name, const char*value)
         i->config_print = atoi(value);
     } else if(!strcmp(name, "onlytext")) {
         i->config_only_text = atoi(value);
+        i->info->only_text = i->config_only_text;
+    } else if(!strcmp(name, "imagecache")) {
+        i->imagecache->setBudget(atoi(value)*1024);
     } else {
         gfxparams_store(i->parameters, name, value);
     }
@@ -288,22 +405,24 @@ void pdf_doc_setparameter(gfxdocument_t*gfx, const char*name, const char*value)
 gfxpage_t* pdf_doc_getpage(gfxdocument_t*doc, int page)
 {
     pdf_doc_internal_t*di= (pdf_doc_internal_t*)doc->internal;
-    if(threadsafe) {
-	/* for multi-thread operation, we need to create a new PDFDoc instance
-	   for each thread */
-	di->doc = 0;
-    }
     if(!di->doc) {
 	di->doc = new PDFDoc(di->fileName, di->userPW);
     }
 
     if(page < 1 || page > doc->num_pages)
         return 0;
+
+    /* with lazyinfo, pages are analyzed the first time they're requested */
+    analyze_page(di, page);
     
     gfxpage_t* pdf_page = (gfxpage_t*)malloc(sizeof(gfxpage_t));
     pdf_page_internal_t*pi= (pdf_page_internal_t*)malloc(sizeof(pdf_page_internal_t));
     memset(pi, 0, sizeof(pdf_page_internal_t));
     pdf_page->internal = pi;
+    if(threadsafe) {
+	/* for multi-thread operation, every page needs its own PDFDoc */
+	pi->doc = docpool_get(di);
+    }
 
     pdf_page->destroy = pdfpage_destroy;
     pdf_page->render = pdfpage_render;
@@ -404,6 +523,7 @@ extern int config_marker_glyph;
 extern int config_normalize_fonts;
 extern int config_remove_font_transforms;
 extern int config_remove_invisible_outlines;
+extern int config_glyph_outlines;
 extern int config_break_on_warning;
 
 static void pdf_setparameter(gfxsource_t*src, const char*name, const char*value)
@@ -413,7 +533,10 @@ static void pdf_setparameter(gfxsource_t*src, const char*name, const char*value)
     gfxparams_store(i->parameters, name, value);
 
     msg("<verbose> setting parameter %s to \"%s\"", name, value);
-    if(!strncmp(name, "fontdir", strlen("fontdir"))) {
+    if(!strcmp(name, "fontcache")) {
+	free(fontcache_dir);
+	fontcache_dir = *value ? strdup(value) : 0;
+    } else if(!strncmp(name, "fontdir", strlen("fontdir"))) {
         addGlobalFontDir(value);
     } else if(!strcmp(name, "addspacechars")) {
 	config_addspace = atoi(value);
@@ -436,6 +559,8 @@ static void pdf_setparameter(gfxsource_t*src, const char*name, const char*value)
 	config_break_on_warning = atoi(value);
     } else if(!strcmp(name, "remove_invisible_outlines")) {
 	config_remove_invisible_outlines = atoi(value);
+    } else if(!strcmp(name, "glyphoutlines")) {
+	config_glyph_outlines = atoi(value);
     } else if(!strcmp(name, "fontquality")) {
 	config_fontquality = atoi(value);
     } else if(!strcmp(name, "bigchar")) {
@@ -448,6 +573,12 @@ static void pdf_setparameter(gfxsource_t*src, const char*name, const char*value)
         addGlobalLanguageDir(value);
     } else if(!strcmp(name, "threadsafe")) {
 	threadsafe = atoi(value);
+    } else if(!strcmp(name, "lazyinfo")) {
+	lazyinfo = atoi(value);
+    } else if(!strcmp(name, "onlytext")) {
+	onlytext = atoi(value);
+    } else if(!strcmp(name, "imagecache")) {
+	imagecache_size = atoi(value);
     } else if(!strcmp(name, "zoomtowidth")) {
 	zoomtowidth = atoi(value);
     } else if(!strcmp(name, "zoom")) {
@@ -467,12 +598,23 @@ static void pdf_setparameter(gfxsource_t*src, const char*name, const char*value)
 	printf("multiply=<times>  Render everything at <times> the resolution\n");
 	printf("poly2bitmap       Convert graphics to bitmaps\n");
 	printf("bitmap            Convert everything to bitmaps\n");
+	printf("threadsafe        Allow pages of a document to be rendered from several threads\n");
+	printf("lazyinfo          Analyze pages on demand instead of when opening the file\n");
+	printf("onlytext          Only extract text, skipping images, shadings and forms without fonts\n");
+	printf("fontcache=<dir>   Keep glyph outlines of embedded fonts in <dir>, for reuse in later runs\n");
+	printf("glyphoutlines=0   Only collect glyph metrics; load outlines if a device needs them\n");
+	printf("imagecache=<kb>   Memory for decoded images shared between pages (default: 32768, 0 disables)\n");
     }	
 }
 
 void pdf_doc_prepare(gfxdocument_t*doc, gfxdevice_t*dev)
 {
     pdf_doc_internal_t*i= (pdf_doc_internal_t*)doc->internal;
+    /* dumpfonts() needs the fonts of the whole document */
+    int t;
+    for(t=1;t<=doc->num_pages;t++) {
+	analyze_page(i, t);
+    }
     i->info->dumpfonts(dev);
 }
 
@@ -485,6 +627,10 @@ static gfxdocument_t*pdf_open(gfxsource_t*src, const char*filename)
     memset(i, 0, sizeof(pdf_doc_internal_t));
     i->parent = src;
     i->parameters = gfxparams_new();
+#ifdef HAVE_PTHREADS
+    pthread_mutex_init(&i->docpool_mutex, 0);
+#endif
+    i->imagecache = new ImageCache(imagecache_size*1024);
     pdf_doc->internal = i;
     char*userPassword=0;
     
@@ -525,32 +671,31 @@ static gfxdocument_t*pdf_open(gfxsource_t*src, const char*filename)
               i->protect = 1;
     }
 	
+    i->zoom = zoom;
+    i->multiply = multiply;
     if(zoomtowidth && i->doc->getNumPages()) {
 	Page*page = i->doc->getCatalog()->getPage(1);
 	PDFRectangle *r = page->getCropBox();
 	double width_before = r->x2 - r->x1;
-	zoom = 72.0 * zoomtowidth / width_before;
-	msg("<notice> Rendering at %f DPI. (Page width at 72 DPI: %f, target width: %d)", zoom, width_before, zoomtowidth);
+	i->zoom = 72.0 * zoomtowidth / width_before;
+	msg("<notice> Rendering at %f DPI. (Page width at 72 DPI: %f, target width: %d)", i->zoom, width_before, zoomtowidth);
     }
 
     i->info = new InfoOutputDev(i->doc->getXRef());
+    /* the analysis pass runs before the document parameters are set */
+    i->info->only_text = onlytext;
+    if(fontcache_dir) {
+	i->info->setFontCache(new FontCache(i->doc->getXRef(), fontcache_dir));
+    }
     int t;
     i->pages = (pdf_page_info_t*)malloc(sizeof(pdf_page_info_t)*pdf_doc->num_pages);
     memset(i->pages,0,sizeof(pdf_page_info_t)*pdf_doc->num_pages);
-    for(t=1;t<=pdf_doc->num_pages;t++) {
-	if(!global_page_range || is_in_range(t, global_page_range)) {
-	    i->doc->displayPage((OutputDev*)i->info, t, zoom, zoom, /*rotate*/0, /*usemediabox*/true, /*crop*/true, i->config_print);
-	    i->doc->processLinks((OutputDev*)i->info, t);
-	    i->pages[t-1].xMin = i->info->x1;
-	    i->pages[t-1].yMin = i->info->y1;
-	    i->pages[t-1].xMax = i->info->x2;
-	    i->pages[t-1].yMax = i->info->y2;
-	    i->pages[t-1].width = i->info->x2 - i->info->x1;
-	    i->pages[t-1].height = i->info->y2 - i->info->y1;
-	    i->pages[t-1].number_of_images = i->info->num_ppm_images + i->info->num_jpeg_images;
-	    i->pages[t-1].number_of_links = i->info->num_links;
-	    i->pages[t-1].number_of_fonts = i->info->num_fonts;
-	    i->pages[t-1].has_info = 1;
+    /* with threadsafe=1, all pages are analyzed upfront: rendering threads
+       read the font tables without locking them, so they can't change
+       while pages are being rendered */
+    if(!lazyinfo || threadsafe) {
+	for(t=1;t<=pdf_doc->num_pages;t++) {
+	    analyze_page(i, t);
 	}
     }
 
@@ -600,6 +745,8 @@ gfxsource_t*gfxsource_pdf_create()
         globalParams = new GFXGlobalParams();
 	//globalparams_count++;
     }
+    /* make sure the feature list exists before any rendering threads do */
+    getGfxGlobals();
     
 
     return src;
@@ -0,0 +1,35 @@
+# Text drawn under a luminosity soft mask. The mask is white on the left half
+# of the page and black on the right half, so only the left half of the text
+# must be visible.
+
+objects = []
+def obj(s):
+    objects.append(s)
+    return len(objects)
+
+mask_content = "1 g 0 0 200 400 re f 0 g 200 0 200 400 re f"
+page_content = "q /GS1 gs BT /F1 80 Tf 0 g 20 170 Td (MASKED) Tj ET Q"
+
+catalog = obj("<< /Type /Catalog /Pages 2 0 R >>")
+pages = obj("<< /Type /Pages /Kids [3 0 R] /Count 1 >>")
+page = obj("<< /Type /Page /Parent 2 0 R /MediaBox [0 0 400 400] /Contents 4 0 R "
+           "/Resources << /Font << /F1 5 0 R >> /ExtGState << /GS1 6 0 R >> >> >>")
+contents = obj("<< /Length %d >>\nstream\n%s\nendstream" % (len(page_content), page_content))
+font = obj("<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>")
+gstate = obj("<< /Type /ExtGState /SMask << /Type /Mask /S /Luminosity /G 7 0 R >> >>")
+mask = obj("<< /Type /XObject /Subtype /Form /BBox [0 0 400 400] "
+           "/Group << /S /Transparency /CS /DeviceGray >> /Length %d >>\nstream\n%s\nendstream" % (len(mask_content), mask_content))
+
+fi = open("smasktext.pdf", "wb")
+data = "%PDF-1.4\n"
+offsets = []
+for i,o in enumerate(objects):
+    offsets.append(len(data))
+    data += "%d 0 obj\n%s\nendobj\n" % (i+1, o)
+xref = len(data)
+data += "xref\n0 %d\n0000000000 65535 f \n" % (len(objects)+1)
+for o in offsets:
+    data += "%010d 00000 n \n" % o
+data += "trailer\n<< /Size %d /Root 1 0 R >>\nstartxref\n%d\n%%%%EOF\n" % (len(objects)+1, xref)
+fi.write(data.encode("latin-1"))
+fi.close()
@@ -0,0 +1,10 @@
+require File.dirname(__FILE__) + '/spec_helper'
+
+describe "pdf conversion" do
+    convert_file "smasktext.pdf" do
+        area_at(26,172,81,230).should_not_be_plain_colored
+        area_at(144,171,190,232).should_not_be_plain_colored
+        area_at(205,160,390,240).should_be_plain_colored
+        pixel_at(300,200).should_be_of_color 0xffffff
+    end
+end
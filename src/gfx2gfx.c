@@ -24,7 +24,12 @@
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
 #include "../config.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include "../lib/args.h"
 #include "../lib/os.h"
 #include "../lib/gfxsource.h"
@@ -33,6 +38,7 @@
 #include "../lib/devices/pdf.h"
 #include "../lib/devices/swf.h"
 #include "../lib/devices/text.h"
+#include "../lib/devices/textlayout.h"
 #include "../lib/devices/render.h"
 #include "../lib/devices/file.h"
 #include "../lib/devices/bbox.h"
@@ -58,6 +64,88 @@ static char * maxdpi = "72";
 static char * pagerange = 0;
 static char * filename = 0;
 static const char * format = 0;
+static int numthreads = 1;
+static char threadsafe_source = 0;
+static char serve = 0;
+
+/* parameters of the PDF driver which are read when a document is opened
+   or rendered, rather than passed to the document. With --serve, -s
+   options of a request set them on the driver, and afterwards they are
+   reset to the values the server was started with (the defaults of
+   lib/pdf/pdf.cc, unless overridden by -s on the command line). */
+static struct {
+    const char*name;
+    const char*value;
+} pdf_source_params[] = {
+    {"fontcache", ""},
+    {"glyphoutlines", "1"},
+    {"imagecache", "32768"},
+    {"lazyinfo", "0"},
+    {"threadsafe", "0"},
+    {"zoom", "72"},
+    {"zoomtowidth", "0"},
+    {"multiply", "1"},
+    {"poly2bitmap", "0"},
+    {"skewedtobitmap", "0"},
+    {"fontquality", "10"},
+    {"bigchar", "0"},
+    {"unique_unicode", "1"},
+    {"marker_glyph", "0"},
+    {"normalize_fonts", "0"},
+    {"remove_font_transforms", "0"},
+    {"remove_invisible_outlines", "0"},
+    {"breakonwarning", "0"},
+    {0, 0}
+};
+
+static int pdf_source_param(const char*name)
+{
+    int t;
+    for(t=0;pdf_source_params[t].name;t++) {
+        if(!strcmp(pdf_source_params[t].name, name))
+            return t;
+    }
+    return -1;
+}
+
+static void set_driver_parameter(const char*name, const char*value)
+{
+    driver->setparameter(driver, name, value);
+    int nr = pdf_source_param(name);
+    if(nr >= 0)
+        pdf_source_params[nr].value = strdup(value);
+}
+
+enum {SOURCE_UNKNOWN, SOURCE_PDF, SOURCE_SWF, SOURCE_IMAGE, NUM_SOURCE_TYPES};
+
+static int source_type(const char*filename)
+{
+    if(strstr(filename, ".pdf") || strstr(filename, ".PDF")) {
+        return SOURCE_PDF;
+    } else if(strstr(filename, ".swf") || strstr(filename, ".SWF")) {
+        return SOURCE_SWF;
+    } else if(strstr(filename, ".jpg") || strstr(filename, ".JPG") ||
+              strstr(filename, ".png") || strstr(filename, ".PNG")) {
+        return SOURCE_IMAGE;
+    }
+    return SOURCE_UNKNOWN;
+}
+
+static gfxsource_t* create_driver(int type)
+{
+    switch(type) {
+        case SOURCE_PDF:
+            msg("<notice> Treating file as PDF");
+            return gfxsource_pdf_create();
+        case SOURCE_SWF:
+            msg("<notice> Treating file as SWF");
+            return gfxsource_swf_create();
+        case SOURCE_IMAGE:
+            msg("<notice> Treating file as Image");
+            return gfxsource_image_create();
+    }
+    return 0;
+}
 
 int args_callback_option(char*name,char*val) {
     if (!strcmp(name, "o"))
@@ -87,6 +175,13 @@ int args_callback_option(char*name,char*val) {
 	maxdpi = val;
 	return 1;
     }
+    else if (!strcmp(name, "j"))
+    {
+	numthreads = atoi(val);
+	if(numthreads < 1)
+	    numthreads = 1;
+	return 1;
+    }
     else if (name[0]=='p')
     {
 	do {
@@ -111,13 +206,24 @@ int args_callback_option(char*name,char*val) {
 	if(c && *c && c[1])  {
 	    *c = 0;
 	    c++;
-	    driver->setparameter(driver, s,c);
+	    set_driver_parameter(s,c);
 	} else {
-	    driver->setparameter(driver, s,"1");
+	    set_driver_parameter(s,"1");
         }
         free(s);
 	return 1;
     }
+    else if (!strcmp(name, "S"))
+    {
+	serve = 1;
+	/* -s options given after --serve go to the (shared) PDF driver.
+	   -j only applies to PDF requests, see serve_requests() */
+	if(!driver) {
+	    driver = create_driver(SOURCE_PDF);
+	    threadsafe_source = 1;
+	}
+	return 0;
+    }
     else if (!strcmp(name, "V"))
     {	
 	printf("gfx2gfx-pdf2text - part of %s %s (build %s)\n", PACKAGE, VERSION, GIT_VERSION_STRING);
@@ -138,6 +244,8 @@ struct options_t options[] =
  {"s","set"},
  {"r","resolution"},
  {"p","pages"},
+ {"j","threads"},
+ {"S","serve"},
  {0,0}
 };
 
@@ -149,18 +257,9 @@ int args_callback_command(char*name, char*val) {
     if (!filename) {
 
         filename = name;
-
-        if(strstr(filename, ".pdf") || strstr(filename, ".PDF")) {
-            msg("<notice> Treating file as PDF");
-            driver = gfxsource_pdf_create();
-        } else if(strstr(filename, ".swf") || strstr(filename, ".SWF")) {
-            msg("<notice> Treating file as SWF");
-            driver = gfxsource_swf_create();
-        } else if(strstr(filename, ".jpg") || strstr(filename, ".JPG") ||
-                  strstr(filename, ".png") || strstr(filename, ".PNG")) {
-            msg("<notice> Treating file as Image");
-            driver = gfxsource_image_create();
-        }
+        int type = source_type(filename);
+        driver = create_driver(type);
+        threadsafe_source = type == SOURCE_PDF;
     } else {
 	if(outputname)
 	{
@@ -177,51 +276,130 @@ void args_callback_usage(char*name)
 {
 }
 
-int main(int argn, char *argv[])
+#ifdef HAVE_PTHREADS
+typedef struct _pagejob {
+    int pagenr;
+    gfxresult_t*result; // the recorded page, once it's rendered
+} pagejob_t;
+
+typedef struct _pagequeue {
+    gfxdocument_t*doc;
+    pagejob_t*jobs;
+    int num_jobs;
+    int next_job;     // the next page to be picked up by a render thread
+    int num_replayed; // pages already passed on to the output device
+    int max_ahead;    // how many rendered pages we keep in memory
+    pthread_mutex_t mutex;
+    pthread_cond_t page_rendered;
+    pthread_cond_t page_replayed;
+} pagequeue_t;
+
+static void* render_thread(void*_queue)
 {
-    processargs(argn, argv);
-    initLog(0,-1,0,0,-1,loglevel);
-    
-    if(!filename) {
-	fprintf(stderr, "Please specify an input file\n");
-	exit(1);
+    pagequeue_t*q = (pagequeue_t*)_queue;
+    while(1) {
+	pthread_mutex_lock(&q->mutex);
+	while(q->next_job < q->num_jobs && q->next_job >= q->num_replayed + q->max_ahead) {
+	    pthread_cond_wait(&q->page_replayed, &q->mutex);
+	}
+	if(q->next_job >= q->num_jobs) {
+	    pthread_mutex_unlock(&q->mutex);
+	    break;
+	}
+	pagejob_t*job = &q->jobs[q->next_job++];
+	pthread_mutex_unlock(&q->mutex);
+
+	gfxdevice_t record;
+	gfxdevice_record_init(&record, 0);
+	/* the fonts belong to the document, which outlives the recording */
+	gfxdevice_record_set_font_references(&record, 1);
+	gfxpage_t* page = q->doc->getpage(q->doc, job->pagenr);
+	record.startpage(&record, page->width, page->height);
+	page->render(page, &record);
+	record.endpage(&record);
+	page->destroy(page);
+	gfxresult_t*result = record.finish(&record);
+
+	pthread_mutex_lock(&q->mutex);
+	job->result = result;
+	pthread_cond_broadcast(&q->page_rendered);
+	pthread_mutex_unlock(&q->mutex);
     }
-    
-    if(!outputname)
-    {
-	if(filename) {
-	    outputname = stripFilename(filename, ".out");
-	    msg("<notice> Output filename not given. Writing to %s", outputname);
-	} 
+    return 0;
+}
+
+/* render pages with several threads, each page into its own record device,
+   and replay the recordings to the output device in page order. Returns the
+   list of fonts passed to the output device (the fonts are owned by the
+   document). */
+static gfxfontlist_t* render_pages_parallel(gfxdocument_t*doc, gfxdevice_t*out)
+{
+    pagequeue_t q;
+    memset(&q, 0, sizeof(q));
+    q.doc = doc;
+    q.jobs = (pagejob_t*)calloc(doc->num_pages+1, sizeof(pagejob_t));
+    int pagenr;
+    for(pagenr = 1; pagenr <= doc->num_pages; pagenr++) {
+	if(is_in_range(pagenr, pagerange)) {
+	    q.jobs[q.num_jobs++].pagenr = pagenr;
+	}
     }
-    if(!outputname)
-    {
-	fprintf(stderr, "Please use -o to specify an output file\n");
-	exit(1);
+    q.max_ahead = numthreads*2;
+    pthread_mutex_init(&q.mutex, 0);
+    pthread_cond_init(&q.page_rendered, 0);
+    pthread_cond_init(&q.page_replayed, 0);
+
+    pthread_t*threads = (pthread_t*)malloc(sizeof(pthread_t)*numthreads);
+    int t;
+    for(t=0;t<numthreads;t++) {
+	pthread_create(&threads[t], 0, render_thread, &q);
     }
-    is_in_range(0x7fffffff, pagerange);
-    if(pagerange)
-	driver->setparameter(driver, "pages", pagerange);
 
-    if(!filename) {
-	args_callback_usage(argv[0]);
-	exit(0);
-    }
+    gfxfontlist_t*fontlist = 0;
+    int nr;
+    for(nr=0;nr<q.num_jobs;nr++) {
+	pthread_mutex_lock(&q.mutex);
+	while(!q.jobs[nr].result) {
+	    pthread_cond_wait(&q.page_rendered, &q.mutex);
+	}
+	gfxresult_t*result = q.jobs[nr].result;
+	pthread_mutex_unlock(&q.mutex);
 
-    gfxdocument_t* doc = driver->open(driver, filename);
-    if(!doc) {
-        msg("<error> Couldn't open %s", filename);
-        exit(1);
-    }
+	gfxresult_record_replay(result, out, &fontlist);
+	result->destroy(result);
 
-    if(!format) {
-	char*x = strrchr(outputname, '.');
-	if(x) 
-	    format = x+1;
+	pthread_mutex_lock(&q.mutex);
+	q.num_replayed = nr+1;
+	pthread_cond_broadcast(&q.page_replayed);
+	pthread_mutex_unlock(&q.mutex);
     }
 
+    for(t=0;t<numthreads;t++) {
+	pthread_join(threads[t], 0);
+    }
+    free(threads);
+    pthread_cond_destroy(&q.page_replayed);
+    pthread_cond_destroy(&q.page_rendered);
+    pthread_mutex_destroy(&q.mutex);
+    free(q.jobs);
+    return fontlist;
+}
+#endif
 
+/* render the pages in pagerange into outputname. Returns the number of
+   pages converted, or -1 if something went wrong */
+static int convert_document(gfxdocument_t*doc, const char*outputname, const char*format)
+{
     gfxresult_t*result = 0;
+    gfxfontlist_t*fontlist = 0; // fonts replayed from recorded pages
+    int textfd = -1; // text output is written while rendering
+    writer_t textwriter;
+    int num_converted = 0;
+    int pagenr;
+    for(pagenr = 1; pagenr <= doc->num_pages; pagenr++) {
+        if(is_in_range(pagenr, pagerange))
+            num_converted++;
+    }
 #ifdef HAVE_LRF
     if(!strcasecmp(format, "lrf")) {
         gfxdevice_t lrf;
@@ -238,8 +416,6 @@ int main(int argn, char *argv[])
         gfxdevice_bbox_init(bbox);
         bbox->setparameter(bbox, "graphics", "0");
 
-        int pagenr;
-
         for(pagenr = 1; pagenr <= doc->num_pages; pagenr++) 
         {
             if(is_in_range(pagenr, pagerange)) {
@@ -266,43 +442,316 @@ int main(int argn, char *argv[])
         } else if(!strcasecmp(format, "img") || !strcasecmp(format, "png")) {
             gfxdevice_render_init(out);
 	    out->setparameter(out, "antialize", "4");
-        } else if(!strcasecmp(format, "txt")) {
-            gfxdevice_text_init(out);
+        } else if(!strcasecmp(format, "txt") || !strcasecmp(format, "layout") ||
+                  !strcasecmp(format, "json") || !strcasecmp(format, "tsv")) {
+            textfd = open(outputname, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if(textfd<0) {
+                msg("<error> Couldn't create %s", outputname);
+                return -1;
+            }
+            writer_init_filewriter(&textwriter, textfd);
+            if(!strcasecmp(format, "txt")) {
+                gfxdevice_text_init_stream(out, &textwriter);
+            } else {
+                /* words, lines and blocks in reading order */
+                gfxdevice_textlayout_init_stream(out, &textwriter);
+                if(!strcasecmp(format, "json"))
+                    out->setparameter(out, "format", "json");
+                else if(!strcasecmp(format, "tsv"))
+                    out->setparameter(out, "format", "tsv");
+            }
         } else if(!strcasecmp(format, "log")) {
             gfxdevice_file_init(out, "/tmp/device.log");
         } else if(!strcasecmp(format, "pdf")) {
             gfxdevice_pdf_init(out);
         } else {
 	    msg("<error> Invalid output format: %s", format);
-	    exit(1);
+	    return -1;
 	}
 	    
 	out->setparameter(out, "maxdpi", maxdpi);
 
-        int pagenr;
-        for(pagenr = 1; pagenr <= doc->num_pages; pagenr++) 
+#ifdef HAVE_PTHREADS
+        if(numthreads > 1) {
+            fontlist = render_pages_parallel(doc, out);
+        } else
+#endif
         {
-            if(is_in_range(pagenr, pagerange)) {
-                gfxpage_t* page = doc->getpage(doc, pagenr);
-                out->startpage(out, page->width, page->height);
-                page->render(page, out);
-                out->endpage(out);
-                page->destroy(page);
+            for(pagenr = 1; pagenr <= doc->num_pages; pagenr++) 
+            {
+                if(is_in_range(pagenr, pagerange)) {
+                    gfxpage_t* page = doc->getpage(doc, pagenr);
+                    out->startpage(out, page->width, page->height);
+                    page->render(page, out);
+                    out->endpage(out);
+                    page->destroy(page);
+                }
             }
         }
         result = out->finish(out);
     }
 
     if(result) {
-	if(result->save(result, outputname) < 0) {
-	    exit(1);
+	if(textfd<0 && result->save(result, outputname) < 0) {
+	    num_converted = -1;
 	}
 	result->destroy(result);
     }
+    if(textfd>=0) {
+	textwriter.finish(&textwriter);
+	close(textfd);
+    }
+    gfxfontlist_free(fontlist, 0);
+    return num_converted;
+}
+
+static const char* format_from_filename(const char*outputname)
+{
+    const char*x = strrchr(outputname, '.');
+    return x ? x+1 : "";
+}
+
+static double time_ms()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec*1000.0 + tv.tv_usec/1000.0;
+}
+
+/* check a page range the way is_in_range() parses it. is_in_range()
+   exits on malformed ranges, which a server can't afford. */
+static char valid_range(const char*range)
+{
+    const char*pos = range;
+    char dash = 0;
+    if(!range)
+        return 1;
+    while(*pos) {
+        while(*pos == ' ' || *pos == '\r' || *pos == '\n' || *pos == '\t')
+            pos++;
+        if(*pos < '0' || *pos > '9')
+            return 0;
+        while(*pos >= '0' && *pos <= '9')
+            pos++;
+        while(*pos == ' ' || *pos == '\r' || *pos == '\n' || *pos == '\t')
+            pos++;
+        /* the character after the second number of a range is skipped
+           like a separator, even if it's a '-' */
+        dash = !dash && *pos == '-';
+        if(*pos)
+            pos++;
+    }
+    return 1;
+}
+
+/* --serve: convert documents for as long as stdin stays open, with the
+   drivers (and hence xpdf's global parameters, fontconfig and the
+   standard fonts) only initialized once. Every line of input is a request
+       <input> <output> [-p <pages>] [-f <format>] [-r <dpi>] [-s <key=value>]...
+   (separated by whitespace), answered by a single line on stdout:
+       ok <pages> <milliseconds>
+       error <milliseconds> <message>
+   -s options on a request line are applied to the document, and those
+   the PDF driver only reads itself (see pdf_source_params) also to the
+   driver. Either way, they don't carry over to later requests. Fonts,
+   font and language directories can only be added at startup. */
+static int serve_requests()
+{
+    /* log messages are written to stdout- keep them out of the answers */
+    FILE*answers = fdopen(dup(1), "w");
+    dup2(2, 1);
+
+    gfxsource_t*drivers[NUM_SOURCE_TYPES];
+    memset(drivers, 0, sizeof(drivers));
+    drivers[SOURCE_PDF] = driver;
+
+    char*default_maxdpi = maxdpi;
+    /* only the PDF driver can render pages from several threads */
+    int pdf_numthreads = numthreads;
+    char line[4096];
+    int t;
+    while(fgets(line, sizeof(line), stdin)) {
+        char*args[64];
+        int num_args = 0;
+        char*a = strtok(line, " \t\r\n");
+        while(a && num_args < 64) {
+            args[num_args++] = a;
+            a = strtok(0, " \t\r\n");
+        }
+        if(!num_args)
+            continue;
+        if(!strcmp(args[0], "quit"))
+            break;
+
+        double start = time_ms();
+        const char*input = 0;
+        const char*output = 0;
+        const char*fmt = 0;
+        const char*error = 0;
+        char*params[64];
+        const char*values[64];
+        int num_params = 0;
+        pagerange = 0;
+        maxdpi = default_maxdpi;
+        for(t=0;t<num_args;t++) {
+            if(args[t][0] == '-' && args[t][1] && !args[t][2] && t+1<num_args) {
+                char*val = args[++t];
+                switch(args[t-1][1]) {
+                    case 'p': pagerange = val; break;
+                    case 'f': fmt = val; break;
+                    case 'r': maxdpi = val; break;
+                    case 's': params[num_params++] = val; break;
+                    default: error = "unknown option";
+                }
+            } else if(!input) {
+                input = args[t];
+            } else if(!output) {
+                output = args[t];
+            } else {
+                error = "too many arguments";
+            }
+        }
+        if(!error && !output)
+            error = "usage: <input> <output> [options]";
+
+        int type = input ? source_type(input) : SOURCE_UNKNOWN;
+        if(!error && type == SOURCE_UNKNOWN)
+            error = "unknown input file type";
+        if(!error && !valid_range(pagerange))
+            error = "invalid page range";
+        for(t=0;t<num_params;t++) {
+            char*c = strchr(params[t], '=');
+            if(c) {
+                *c = 0;
+                values[t] = c+1;
+            } else {
+                values[t] = "1";
+            }
+            if(!error && type == SOURCE_PDF && pdf_source_param(params[t]) < 0 &&
+               (!strncmp(params[t], "font", 4) || !strncmp(params[t], "languagedir", 11))) {
+                error = "fonts and directories can only be added at startup";
+            }
+        }
+
+        numthreads = type == SOURCE_PDF ? pdf_numthreads : 1;
+
+        int num_pages = -1;
+        if(!error) {
+            if(!drivers[type])
+                drivers[type] = create_driver(type);
+            gfxsource_t*src = drivers[type];
+            if(pagerange)
+                src->setparameter(src, "pages", pagerange);
+            if(type == SOURCE_PDF) {
+                for(t=0;t<num_params;t++) {
+                    if(pdf_source_param(params[t]) < 0)
+                        continue;
+                    src->setparameter(src, params[t], values[t]);
+                    if(!strcmp(params[t], "threadsafe") && !atoi(values[t]))
+                        numthreads = 1;
+                }
+            }
+            gfxdocument_t*doc = src->open(src, input);
+            if(!doc) {
+                msg("<error> Couldn't open %s", input);
+                error = "couldn't open input file";
+            } else {
+                for(t=0;t<num_params;t++) {
+                    doc->setparameter(doc, params[t], values[t]);
+                }
+                num_pages = convert_document(doc, output, fmt ? fmt : format_from_filename(output));
+                if(num_pages < 0)
+                    error = "conversion failed";
+                doc->destroy(doc);
+            }
+            if(type == SOURCE_PDF) {
+                for(t=0;t<num_params;t++) {
+                    int nr = pdf_source_param(params[t]);
+                    if(nr >= 0)
+                        src->setparameter(src, params[t], pdf_source_params[nr].value);
+                }
+            }
+        }
+        if(error) {
+            fprintf(answers, "error %.1f %s\n", time_ms() - start, error);
+        } else {
+            fprintf(answers, "ok %d %.1f\n", num_pages, time_ms() - start);
+        }
+        fflush(answers);
+    }
+
+    for(t=0;t<NUM_SOURCE_TYPES;t++) {
+        if(drivers[t])
+            drivers[t]->destroy(drivers[t]);
+    }
+    fclose(answers);
+    return 0;
+}
+
+int main(int argn, char *argv[])
+{
+    processargs(argn, argv);
+    initLog(0,-1,0,0,-1,loglevel);
+    
+    if(serve) {
+        if(filename) {
+            fprintf(stderr, "With --serve, input files are read from stdin\n");
+            exit(1);
+        }
+    } else {
+        if(!filename) {
+            fprintf(stderr, "Please specify an input file\n");
+            exit(1);
+        }
+
+        if(!outputname)
+        {
+            outputname = stripFilename(filename, ".out");
+            msg("<notice> Output filename not given. Writing to %s", outputname);
+        }
+        if(!driver) {
+            fprintf(stderr, "Unknown input file type: %s\n", filename);
+            exit(1);
+        }
+        is_in_range(0x7fffffff, pagerange);
+        if(pagerange)
+            driver->setparameter(driver, "pages", pagerange);
+    }
+
+    if(numthreads > 1) {
+#ifdef HAVE_PTHREADS
+	if(threadsafe_source) {
+	    set_driver_parameter("threadsafe", "1");
+	} else {
+	    msg("<warning> Multithreading (-j) is only supported for PDF files");
+	    numthreads = 1;
+	}
+#else
+	msg("<warning> Compiled without thread support, ignoring -j");
+	numthreads = 1;
+#endif
+    }
+
+    if(serve) {
+        return serve_requests();
+    }
+
+    gfxdocument_t* doc = driver->open(driver, filename);
+    if(!doc) {
+        msg("<error> Couldn't open %s", filename);
+        exit(1);
+    }
+
+    if(!format) {
+	format = format_from_filename(outputname);
+    }
+
+    if(convert_document(doc, outputname, format) < 0) {
+	exit(1);
+    }
 
     doc->destroy(doc);
 
     driver->destroy(driver);
     return 0;
 }
-